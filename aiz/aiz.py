@@ -1,9 +1,24 @@
 #!/usr/bin/env python3
 
 import argparse
+import contextlib
 import sys
-from aiz.hwinfo import DetectHardware, PrintHardwareInfo, gpuDevices, DisplayStats
-from time import sleep
+import signal
+from aiz.hwinfo import DetectHardware, PrintHardwareInfo, GetDevices, SetDevices, DisplayStats, DisplayProcesses, DisplayCores, DisplayCluster, DisplayInstrumentation, DisplayBottleneck, DisplayInterconnect, GraphWidth
+from aiz.history import DEFAULT_HISTORY
+from aiz.sampler import Sampler, DEFAULT_INTERVAL, DEFAULT_IDLE_INTERVAL
+from aiz.screen import FrameBuffer, Panel, Lines, drawLines
+from aiz.record import Recorder
+from aiz.replay import Replay
+from aiz.exporter import MetricsExporter
+from aiz.stream import Streamer, STREAM_FORMATS, STREAM_RECORDS, STREAM_SECONDS
+from aiz.trigger import Trigger, TriggerCapture, DEFAULT_PRE_SECONDS, DEFAULT_POST_SECONDS
+from aiz.processes import ProcessMonitor
+from aiz.instrument import SelfUsage, recordFrame
+from aiz.rollup import Rollups
+from aiz.bottleneck import BottleneckAnalyzer
+from aiz.cluster import ClusterAgent, ClusterView, AGENT_PORT
+import time
 import curses
 
 __version__ = '0.3.1'
@@ -13,6 +28,28 @@ def ParseCmdLine(argv):
     parser = argparse.ArgumentParser()
     parser.add_argument('--version', default=False, action='store_true')
     parser.add_argument('--showhwinfo', default=False, action='store_true')
+    parser.add_argument('--no-dcgm', default=False, action='store_true', help='sample NVIDIA GPUs with NVML only, leaves the profiling counters to other tools')
+    parser.add_argument('--host', default=False, action='store_true', help='account for the whole host and list every GPU, even in a container or with *_VISIBLE_DEVICES set')
+    parser.add_argument('--history', default=DEFAULT_HISTORY, type=int, help='number of samples kept for each metric')
+    parser.add_argument('--interval', default=DEFAULT_INTERVAL, type=float, help='time between samples in seconds')
+    parser.add_argument('--adaptive', nargs='?', const=DEFAULT_IDLE_INTERVAL, default=None, type=float, metavar='IDLE',
+                        help='sample every IDLE seconds while the metrics are flat, and every --interval while they move')
+    parser.add_argument('--threads', default=None, type=int, help='devices sampled in parallel, 1 samples them in order')
+    parser.add_argument('--fps', default=30.0, type=float, help='display refresh rate')
+    parser.add_argument('--record', default=None, metavar='FILE', help='record every metric to FILE without a display')
+    parser.add_argument('--exporter', default=None, type=int, metavar='PORT', help='serve Prometheus metrics on PORT without a display')
+    parser.add_argument('--stream', default=None, choices=STREAM_FORMATS, help='write every sample to stdout as JSON lines or CSV without a display')
+    parser.add_argument('--stream-records', default=STREAM_RECORDS, type=int, metavar='N', help='most samples buffered before a write to stdout')
+    parser.add_argument('--stream-latency', default=STREAM_SECONDS, type=float, metavar='SECONDS', help='most time a sample stays buffered')
+    parser.add_argument('--trigger', default=[], action='append', metavar='EXPR',
+                        help="save the samples around each time EXPR starts holding, like 'gpu_usage < 30 for 200 ms while cpu_usage > 90'")
+    parser.add_argument('--trigger-window', default='%g:%g' % (DEFAULT_PRE_SECONDS, DEFAULT_POST_SECONDS), metavar='BEFORE:AFTER',
+                        help='seconds saved before and after a trigger')
+    parser.add_argument('--trigger-dir', default='.', metavar='DIR', help='directory the trigger captures are written to')
+    parser.add_argument('--replay', default=None, metavar='FILE', help='display a recording instead of the live devices')
+    parser.add_argument('--agent', default=None, type=int, nargs='?', const=AGENT_PORT, metavar='PORT', help='stream metrics to cluster viewers on PORT without a display')
+    parser.add_argument('--cluster', default=None, metavar='HOST[:PORT],...', help='display the metrics streamed by the agents of several nodes')
+    parser.add_argument('--range', default=None, metavar='START:END', help='replayed range, in seconds from the start of the recording')
 
     #print(argv)
     args = parser.parse_args(argv)
@@ -23,16 +60,49 @@ def ParseCmdLine(argv):
 def InitDisplay():
     return curses.initscr()
 
-def DisplayMenu(win):
+def DisplayMenu(win, panels, status=None):
     win.addch('\n')
     win.addch('\n')
     win.addstr("q:Quit")
+    for panel in panels:
+        win.addstr("  %s:%s" % (panel.key, panel.title))
+    if status:
+        win.addstr("  " + status)
+
+def ParseRange(text):
+    """ Return (start, end) in seconds from a START:END string, either side can be empty """
+    if not text:
+        return (None, None)
+    start, _, end = text.partition(':')
+    return (float(start) if start else None, float(end) if end else None)
 
 def Shutdown(win):
     curses.endwin()
     sys.exit(0)
 
-def MainLoop(win):
+def RunHeadless(sampler):
+    """ Keep sampling without a display until interrupted or terminated """
+    signal.signal(signal.SIGTERM, lambda signum, frame: sampler.stopEvent.set())
+    try:
+        while sampler.is_alive():
+            sampler.join(0.5)
+    except KeyboardInterrupt:
+        pass
+    sampler.Stop()
+    if sampler.error:
+        raise sampler.error
+
+def MainLoop(win, source, fps, panels=[], display=DisplayStats, controls=[]):
+    """ Draw the devices until q is pressed
+
+    Parameters:
+    win -- curses window
+    source -- Sampler, or Replay which also gets Update() and HandleKey() calls
+    fps -- Display refresh rate
+    panels -- Optional Panel sections, toggled by their key
+    display -- Function drawing the main section
+    controls -- Objects with HandleKey(key, width) and Status(), a handled key redraws the frame
+    """
     if not curses.has_colors():
         print('Error: Terminal does not support color')
         Shutdown(win)
@@ -41,23 +111,70 @@ def MainLoop(win):
     #COLOR_CYAN
     curses.init_pair(1, curses.COLOR_GREEN, curses.COLOR_BLACK)
     curses.noecho()
-    win.nodelay(True)
+    curses.cbreak()
+    win.keypad(True)
 
+    update = getattr(source, 'Update', None)
+    handleKey = getattr(source, 'HandleKey', None)
+    status = getattr(source, 'Status', None)
+
+    frame = FrameBuffer(win)
+    frameTime = 1.0 / fps
+    nextFrame = time.monotonic()
+    # Sampler generation shown by the current frame, None forces a redraw
+    drawn = None
     while(True):
-        sleep(0.01)
-        win.clear()
-     
-        DisplayStats(win, curses)
+        if source.error:
+            raise source.error
+        if update:
+            update()
+
+        now = time.monotonic()
+        if now >= nextFrame:
+            # Nothing to do until the sampler has completed a new pass
+            if drawn != source.generation:
+                drawn = source.generation
+                drawStart = time.perf_counter()
+
+                # Panels are drawn first, so the main section knows the lines they take
+                panelLines = Lines(win)
+                for panel in panels:
+                    if panel.shown:
+                        panel.draw(panelLines, curses)
+                frame.reserved = len(panelLines.lines) - 1
 
-        DisplayMenu(win)
+                display(frame, curses)
+                drawLines(frame, panelLines)
 
-        curses.cbreak()
+                statuses = [status()] if status else []
+                statuses.extend(control.Status() for control in controls)
+                DisplayMenu(frame, panels, '  '.join(statuses))
+
+                frame.Flush()
+                recordFrame(time.perf_counter() - drawStart)
+
+            nextFrame += frameTime
+            if nextFrame < now:
+                nextFrame = now + frameTime
+
+        # Wait for the next frame in getch so keys are handled right away
+        win.timeout(max(0, int((nextFrame - time.monotonic()) * 1000)))
         key = win.getch()
-        curses.nocbreak()
         if key == 113:
             Shutdown(win)
-
-        win.refresh()
+        elif key == curses.KEY_RESIZE:
+            frame.Invalidate()
+            drawn = None
+        elif key in [ord(panel.key) for panel in panels]:
+            for panel in panels:
+                if key == ord(panel.key):
+                    panel.shown = not panel.shown
+            drawn = None
+        elif key != -1:
+            if any(control.HandleKey(key, GraphWidth(win)) for control in controls):
+                drawn = None
+            elif handleKey:
+                handleKey(key, GraphWidth(win))
 
 
 def main(argv):
@@ -69,23 +186,130 @@ def main(argv):
         return
 
 
-    DetectHardware()
-    
+    if args.replay:
+        start, end = ParseRange(args.range)
+        replay = Replay(args.replay, start, end)
+        SetDevices(replay.GpuDevices(), replay.CpuDevice())
+        win = None
+        try:
+            win = InitDisplay()
+            if args.range:
+                replay.FitRange(GraphWidth(win))
+            MainLoop(win, replay, max(0.1, args.fps))
+        except Exception as e:
+            print(e)
+            Shutdown(win)
+        return
+
+    if args.cluster:
+        view = ClusterView([address for address in args.cluster.split(',') if address], max(1, args.history))
+        win = None
+        try:
+            win = InitDisplay()
+            MainLoop(win, view, max(0.1, args.fps), display=lambda win, curses: DisplayCluster(win, curses, view))
+        except Exception as e:
+            print(e)
+            Shutdown(win)
+        return
+
+    if args.stream:
+        # stdout only carries the stream
+        with contextlib.redirect_stdout(sys.stderr):
+            DetectHardware(max(1, args.history), not args.no_dcgm, not args.host)
+    else:
+        DetectHardware(max(1, args.history), not args.no_dcgm, not args.host)
+
     if args.showhwinfo is True:
         PrintHardwareInfo()
         return
 
+    interval = max(0.0, args.interval)
+    # Armed triggers keep the pre-trigger buffer at the full rate
+    idleInterval = None if args.adaptive is None or args.trigger else max(interval, args.adaptive)
+    sampler = Sampler(GetDevices(), interval, args.threads and max(1, args.threads), idleInterval)
+
+    capture = None
+    if args.trigger:
+        try:
+            before, after = ParseRange(args.trigger_window)
+            devices = GetDevices()
+            capture = TriggerCapture([Trigger(text) for text in args.trigger], devices[:-1], devices[-1], interval,
+                                     args.trigger_dir, max(0.0, before if before is not None else DEFAULT_PRE_SECONDS),
+                                     max(0.0, after if after is not None else DEFAULT_POST_SECONDS))
+        except ValueError as e:
+            print(e)
+            return
+        sampler.AddListener(capture.Record)
+
+    # Headless outputs, closed when sampling stops
+    outputs = []
+    if args.record:
+        recorder = Recorder(args.record, GetDevices(), interval)
+        sampler.AddListener(recorder.Record)
+        outputs.append(recorder)
+    if args.exporter is not None:
+        devices = GetDevices()
+        exporter = MetricsExporter(args.exporter, devices[:-1], devices[-1])
+        sampler.AddListener(exporter.Update)
+        exporter.Start()
+        outputs.append(exporter)
+    if args.agent is not None:
+        agent = ClusterAgent(args.agent, GetDevices(), interval)
+        sampler.AddListener(agent.Update)
+        agent.Start()
+        outputs.append(agent)
+    if args.stream:
+        streamer = Streamer(sys.stdout.fileno(), GetDevices(), args.stream, sampler.stopEvent.set,
+                            args.stream_records, max(0.0, args.stream_latency))
+        sampler.AddListener(streamer.Record)
+        outputs.append(streamer)
+
+    if outputs:
+        if capture:
+            outputs.append(capture)
+        sampler.start()
+        try:
+            RunHeadless(sampler)
+        finally:
+            for output in outputs:
+                output.Close()
+        return
+
+    rollups = Rollups(GetDevices(), lambda devices: SetDevices(devices[:-1], devices[-1]))
+    sampler.AddListener(rollups.Update)
+    devices = GetDevices()
+    analyzer = BottleneckAnalyzer(devices[:-1], devices[-1])
+    sampler.AddListener(analyzer.Update)
+    sampler.start()
+
+    processes = ProcessMonitor(GetDevices()[:-1])
+    panels = [Panel('p', 'Processes', lambda win, curses: DisplayProcesses(win, curses, processes.Processes())),
+              Panel('c', 'Cores', DisplayCores)]
+    usage = SelfUsage()
+    panels.append(Panel('i', 'Self', lambda win, curses: DisplayInstrumentation(win, curses, usage)))
+    panels.append(Panel('b', 'Bottleneck', lambda win, curses: DisplayBottleneck(win, curses, analyzer)))
+    panels.append(Panel('l', 'Links', DisplayInterconnect))
+
+    controls = [rollups]
+    if capture:
+        controls.append(capture)
+
     win = None
 
     try:
         win = InitDisplay()
-        MainLoop(win)
+        MainLoop(win, sampler, max(0.1, args.fps), panels, controls=controls)
     except Exception as e:
         print(e)
         Shutdown(win)
+    finally:
+        if capture:
+            # Quitting exits through Shutdown(), the captures in progress are still saved
+            sampler.Stop()
+            capture.Close()
 
 def run_main():
-    main(sys.argv[1:])
+    main(sys.argv)
 
 if __name__ == '__main__':
     main(sys.argv)
\ No newline at end of file
@@ -0,0 +1,144 @@
+#=============================================
+# Decoder of the amdgpu gpu_metrics sysfs table, one binary struct with the
+# activity, temperatures, clocks, power, throttle status and, on MI300,
+# the XGMI traffic of a dGPU.
+# Layouts follow struct gpu_metrics_v1_* in kgd_pp_interface.h
+#=============================================
+
+import struct
+from aiz.throttle import THROTTLE_SW_POWER_CAP, THROTTLE_HW_SLOWDOWN, THROTTLE_SW_THERMAL, THROTTLE_HW_THERMAL, THROTTLE_HW_POWER_BRAKE
+
+
+# Largest table read, every v1 table is a few hundred bytes
+GPU_METRICS_SIZE = 1024
+
+# structure_size, format_revision, content_revision
+GPU_METRICS_HEADER = struct.Struct('<HBB')
+# v1.0: header, system_clock_counter, 6 temperatures, 3 activities, socket power,
+# energy, 7 average clocks, 7 current clocks, throttle status, fan, link width and speed
+GPU_METRICS_V1_0 = struct.Struct('<HBBxxxxQ6H3HHI7H7HIHBB')
+# v1.1 to v1.3 share this prefix: header, 6 temperatures, 3 activities, socket power,
+# energy, system_clock_counter, 7 average clocks, 7 current clocks, throttle status,
+# fan, link width and speed, padding, 2 activity accumulators, 4 HBM temperatures
+GPU_METRICS_V1_1 = struct.Struct('<HBB6H3HHQQ7H7HIHHHHII4H')
+# v1.3 adds the firmware timestamp, 4 voltages then the ASIC independent throttle status
+GPU_METRICS_V1_3_THROTTLE = struct.Struct('<Q')
+GPU_METRICS_V1_3_THROTTLE_OFFSET = 112
+# v1.4 (MI300): header, hotspot, memory and VR temperatures, socket power, 2 activities,
+# 4 VCN activities, energy, system_clock_counter, throttle and clock lock status, PCIe
+# and XGMI link width and speed, 2 activity accumulators, 5 PCIe accumulators, XGMI
+# read and write accumulators of 8 links, firmware timestamp, 8 gfx, 4 soc, 4 vclk
+# and 4 dclk current clocks, uclk and padding
+GPU_METRICS_V1_4 = struct.Struct('<HBB3HH2H4HQQIIHHHHIIQQQQQ8Q8QQ8H4H4H4HHH')
+NUM_XGMI_LINKS = 8
+
+# Fields the SMU doesn't report are set to all ones
+UNSUPPORTED_16 = 0xffff
+UNSUPPORTED_64 = 0xffffffffffffffff
+
+# Field positions in each layout: (first temperature, first activity, first current clock)
+V1_0_POSITIONS = (4, 10, 22)
+V1_1_POSITIONS = (3, 9, 22)
+# v1.4 has no edge temperature, its first temperature is the hotspot one
+V1_4_POSITIONS = (3, 7, 45)
+V1_4_SOCKET_POWER = 6
+V1_4_CLOCK_COUNTER = 14
+V1_4_XGMI_READ = 28
+V1_4_XGMI_WRITE = V1_4_XGMI_READ + NUM_XGMI_LINKS
+V1_4_UCLK = 65
+
+# ASIC independent throttler bits (SMU_THROTTLER_*) as NVML reasons, by bit range
+INDEPENDENT_THROTTLE_REASONS = [
+    # PPT, SPL, FPPT and SPPT power limits
+    (0x000000000000ffff, THROTTLE_SW_POWER_CAP),
+    # TDC current and EDC limits
+    (0x00000000ffff0000, THROTTLE_HW_SLOWDOWN),
+    # GPU, core, memory, edge, hotspot, SoC, VR and liquid temperatures
+    (0x00000fff00000000, THROTTLE_SW_THERMAL),
+    # VRHOT and PROCHOT signals
+    (0x0003f00000000000, THROTTLE_HW_THERMAL),
+    # Peak power management and FIT
+    (0xff00000000000000, THROTTLE_HW_POWER_BRAKE),
+]
+
+
+def supported(value):
+    return None if value == UNSUPPORTED_16 else value
+
+def decodeXgmi(fields):
+    """ Return the read + write KB of every XGMI link of a v1.4 table, None for a link the SMU doesn't count """
+    links = []
+    for i in range(0, NUM_XGMI_LINKS):
+        read, write = fields[V1_4_XGMI_READ + i], fields[V1_4_XGMI_WRITE + i]
+        links.append(None if read == UNSUPPORTED_64 or write == UNSUPPORTED_64 else read + write)
+    return links
+
+def decodeGpuMetricsV1_4(fields):
+    temperatures, activities, clocks = V1_4_POSITIONS
+    return {
+        'temp_edge' : None,
+        'temp_hotspot' : supported(fields[temperatures]),
+        'gfx_activity' : supported(fields[activities]),
+        'umc_activity' : supported(fields[activities + 1]),
+        'socket_power' : supported(fields[V1_4_SOCKET_POWER]),
+        'gfxclk' : supported(fields[clocks]),
+        'uclk' : supported(fields[V1_4_UCLK]),
+        # The throttle status of v1.4 is ASIC specific again
+        'throttle' : None,
+        'xgmi' : decodeXgmi(fields),
+        'timestamp' : fields[V1_4_CLOCK_COUNTER] / 1e9,
+    }
+
+def decodeGpuMetrics(data, length):
+    """ Return the metrics of a gpu_metrics table, or None for an unknown or truncated one
+
+    The result holds gfx_activity and umc_activity in %, temp_edge and
+    temp_hotspot in degrees, socket_power in W, gfxclk and uclk in MHz,
+    each None when the SMU doesn't report it, and throttle as NVML reasons,
+    None outside v1.3 where the status is ASIC specific. From v1.4, xgmi
+    holds the cumulative KB moved by each XGMI link and timestamp the
+    driver time of the table in seconds, both None on older tables.
+
+    Parameters:
+    data -- Buffer holding the table
+    length -- Number of bytes read into the buffer
+    """
+    if length < GPU_METRICS_HEADER.size:
+        return None
+    size, formatRevision, contentRevision = GPU_METRICS_HEADER.unpack_from(data)
+    if formatRevision != 1 or size > length:
+        return None
+    if contentRevision == 0:
+        layout, positions = GPU_METRICS_V1_0, V1_0_POSITIONS
+    elif contentRevision <= 3:
+        layout, positions = GPU_METRICS_V1_1, V1_1_POSITIONS
+    elif contentRevision == 4:
+        if size < GPU_METRICS_V1_4.size:
+            return None
+        return decodeGpuMetricsV1_4(GPU_METRICS_V1_4.unpack_from(data))
+    else:
+        # v1.5 and later insert fields before the XGMI counters
+        return None
+    if size < layout.size:
+        return None
+    fields = layout.unpack_from(data)
+    temperatures, activities, clocks = positions
+    throttle = None
+    if contentRevision == 3 and size >= GPU_METRICS_V1_3_THROTTLE_OFFSET + GPU_METRICS_V1_3_THROTTLE.size:
+        status = GPU_METRICS_V1_3_THROTTLE.unpack_from(data, GPU_METRICS_V1_3_THROTTLE_OFFSET)[0]
+        throttle = 0
+        for mask, reason in INDEPENDENT_THROTTLE_REASONS:
+            if status & mask:
+                throttle |= reason
+    return {
+        'temp_edge' : supported(fields[temperatures]),
+        'temp_hotspot' : supported(fields[temperatures + 1]),
+        'gfx_activity' : supported(fields[activities]),
+        'umc_activity' : supported(fields[activities + 1]),
+        'socket_power' : supported(fields[activities + 3]),
+        'gfxclk' : supported(fields[clocks]),
+        'uclk' : supported(fields[clocks + 2]),
+        'throttle' : throttle,
+        'xgmi' : None,
+        'timestamp' : None,
+    }
@@ -0,0 +1,108 @@
+from collections import deque
+from aiz.history import metricValue
+
+
+# Length of one classified window, in seconds
+WINDOW_SECONDS = 1.0
+# Windows kept for the recent fractions, and stall periods kept for the panel
+RECENT_WINDOWS = 60
+MAX_PERIODS = 32
+
+# Mean GPU usage above which a window is GPU-bound
+GPU_BOUND = 80.0
+# Busiest PCIe direction, in % of the link, above which an underfed GPU waits on transfers
+TRANSFER_BOUND = 50.0
+# GPU and CPU usage below which nothing is running
+IDLE_GPU = 10.0
+IDLE_CPU = 20.0
+
+CLASS_GPU = 'GPU-bound'
+CLASS_INPUT = 'input-bound'
+CLASS_TRANSFER = 'transfer-bound'
+CLASS_IDLE = 'idle'
+CLASSES = [CLASS_GPU, CLASS_INPUT, CLASS_TRANSFER, CLASS_IDLE]
+
+
+def classifyWindow(gpu, pcie, cpu):
+    """ Return the class of a window from its mean GPU usage, PCIe % of the link and CPU usage
+
+    A GPU kept busy is GPU-bound. An underfed GPU is transfer-bound when the
+    link is busy, idle when the CPU is quiet too, and input-bound otherwise,
+    waiting on a dataloader whether it saturates every core or a single one.
+    """
+    if gpu >= GPU_BOUND:
+        return CLASS_GPU
+    if pcie >= TRANSFER_BOUND:
+        return CLASS_TRANSFER
+    if gpu < IDLE_GPU and cpu < IDLE_CPU:
+        return CLASS_IDLE
+    return CLASS_INPUT
+
+
+class BottleneckAnalyzer:
+    """ Classifies the run, window by window, from the GPU, PCIe and CPU histories
+
+    Each sampler pass only adds the newest values to the sums of the open
+    window, so the cost does not depend on the history length. A closed
+    window gets one of CLASSES, is counted for the whole run and the last
+    RECENT_WINDOWS windows, and extends the current period of its class.
+    Periods other than GPU-bound are the stalls shown by the panel.
+
+    Parameters:
+    gpus -- GPU devices found by DetectHardware()
+    cpu -- CPU device found by DetectHardware()
+    window -- Window length in seconds
+    """
+    def __init__(self, gpus, cpu, window=WINDOW_SECONDS):
+        self.gpus = gpus
+        self.cpu = cpu
+        self.window = window
+        self.start = None
+        self.samples = 0
+        self.gpuSum = 0.0
+        self.pcieSum = 0.0
+        self.cpuSum = 0.0
+        self.totals = dict((name, 0) for name in CLASSES)
+        self.recent = deque(maxlen=RECENT_WINDOWS)
+        # Periods as [class, start timestamp, end timestamp], the last one still growing
+        self.periods = deque(maxlen=MAX_PERIODS)
+
+    def Update(self, timestamp):
+        """ Sampler listener, adds the newest sample to the open window """
+        if self.start is None:
+            self.start = timestamp
+        elif timestamp - self.start >= self.window:
+            self.close(timestamp)
+            self.start = timestamp
+        if self.gpus:
+            self.gpuSum += sum(metricValue(gpu, 'gpu_usage') for gpu in self.gpus) / len(self.gpus)
+            self.pcieSum += sum(max(metricValue(gpu, 'pcie_tx'), metricValue(gpu, 'pcie_rx')) for gpu in self.gpus) / len(self.gpus)
+        self.cpuSum += metricValue(self.cpu, 'cpu_usage')
+        self.samples += 1
+
+    def close(self, end):
+        if self.samples:
+            name = classifyWindow(self.gpuSum / self.samples, self.pcieSum / self.samples, self.cpuSum / self.samples)
+            self.totals[name] += 1
+            self.recent.append(name)
+            if self.periods and self.periods[-1][0] == name and self.periods[-1][2] == self.start:
+                self.periods[-1][2] = end
+            else:
+                self.periods.append([name, self.start, end])
+        self.samples = 0
+        self.gpuSum = 0.0
+        self.pcieSum = 0.0
+        self.cpuSum = 0.0
+
+    def Fractions(self, recent=False):
+        """ Return {class: fraction of the windows} of the whole run, or of the recent windows """
+        counts = self.totals
+        if recent:
+            names = list(self.recent)
+            counts = dict((name, names.count(name)) for name in CLASSES)
+        total = sum(counts.values())
+        return dict((name, counts[name] / float(total) if total else 0.0) for name in CLASSES)
+
+    def Stalls(self):
+        """ Return the periods other than GPU-bound, newest first, as (class, start, end) """
+        return [tuple(period) for period in reversed(list(self.periods)) if period[0] != CLASS_GPU]
@@ -0,0 +1,311 @@
+import json
+import socket
+import struct
+import threading
+import time
+import logging
+import curses
+import numpy as np
+from aiz.history import RingBuffer, metricValue
+from aiz.record import recordHeader
+
+
+AGENT_PORT = 9401
+# Samples are sent in batches of this many seconds
+BATCH_SECONDS = 0.5
+# Viewers retry unreachable agents this often
+RECONNECT_SECONDS = 5.0
+SEND_TIMEOUT = 2.0
+# Viewers drop an agent that sent nothing for this many batches, or sampling intervals if longer,
+# a node that lost power or its network never closes the connection
+RECEIVE_BATCHES = 6
+
+# Stream layout:
+#   AGENT_MAGIC, then length-prefixed frames, each one a uint32 little endian length and a payload
+#   The first frame is the JSON recording header of the agent devices
+#   Every other frame is a batch: BATCH_HEADER (base timestamp, samples, columns),
+#   float32 timestamp offsets from the base, a bit per value set when it changed
+#   since the previous sample, and the float32 changed values
+AGENT_MAGIC = b'AIZNET1\n'
+BATCH_HEADER = struct.Struct('<dII')
+LENGTH = struct.Struct('<I')
+
+
+def encodeBatch(timestamps, rows, previous):
+    """ Return the payload of a batch frame
+
+    Parameters:
+    timestamps -- float64 array of the sample times
+    rows -- float32 array, one row of column values per sample
+    previous -- Row before the first one, None to send every value
+    """
+    if previous is None:
+        mask = np.ones(rows.shape, dtype=bool)
+    else:
+        mask = rows != np.vstack([previous[None, :], rows[:-1]])
+    return (BATCH_HEADER.pack(timestamps[0], rows.shape[0], rows.shape[1]) +
+            (timestamps - timestamps[0]).astype('<f4').tobytes() +
+            np.packbits(mask).tobytes() +
+            rows[mask].astype('<f4').tobytes())
+
+def decodeBatch(payload, previous):
+    """ Return (timestamps, rows) of a batch frame
+
+    Parameters:
+    payload -- Frame payload
+    previous -- Last decoded row, unchanged values are carried from it
+    """
+    base, samples, columns = BATCH_HEADER.unpack_from(payload, 0)
+    offset = BATCH_HEADER.size
+    timestamps = base + np.frombuffer(payload, dtype='<f4', count=samples, offset=offset).astype(np.float64)
+    offset += 4 * samples
+    maskBytes = (samples * columns + 7) // 8
+    mask = np.unpackbits(np.frombuffer(payload, dtype=np.uint8, count=maskBytes, offset=offset))[:samples * columns]
+    mask = mask.reshape(samples, columns).astype(bool)
+    offset += maskBytes
+    values = np.frombuffer(payload, dtype='<f4', offset=offset)
+
+    # Row 0 is the previous sample, every cell takes the value of the last row that changed it
+    full = np.zeros((samples + 1, columns), dtype=np.float32)
+    if previous is not None:
+        full[0] = previous
+    full[1:][mask] = values
+    source = np.where(mask, np.arange(1, samples + 1)[:, None], 0)
+    source = np.maximum.accumulate(source, axis=0)
+    return (timestamps, full[source, np.arange(0, columns)[None, :]])
+
+def sendFrame(sock, payload):
+    sock.sendall(LENGTH.pack(len(payload)) + payload)
+
+def receiveExactly(sock, size):
+    data = bytearray()
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError('Connection closed')
+        data.extend(chunk)
+    return bytes(data)
+
+def receiveFrame(sock):
+    return receiveExactly(sock, LENGTH.unpack(receiveExactly(sock, LENGTH.size))[0])
+
+
+class ClusterAgent:
+    """ Streams the metrics of this node to cluster viewers
+
+    The sampler listener only copies the newest values. A separate thread
+    encodes the samples of each BATCH_SECONDS once and sends the same bytes
+    to every viewer, so the cost doesn't grow with the number of viewers.
+
+    Parameters:
+    port -- TCP port to listen on, on every interface
+    devices -- Devices found by DetectHardware()
+    interval -- Sampling interval in seconds
+    """
+    def __init__(self, port, devices, interval):
+        self.header = json.dumps(recordHeader(devices, interval)).encode()
+        self.columns = []
+        for device in devices:
+            for name in device.METRICS:
+                self.columns.append((device, name))
+        self.lock = threading.Lock()
+        self.timestamps = []
+        self.rows = []
+        # Last sent row, new viewers get it as a keyframe
+        self.last = None
+        self.clients = []
+        self.server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.server.bind(('', port))
+        self.server.listen(16)
+        self.stopEvent = threading.Event()
+        self.acceptThread = threading.Thread(target=self.accept, name='aiz-agent-accept', daemon=True)
+        self.sendThread = threading.Thread(target=self.send, name='aiz-agent-send', daemon=True)
+
+    def Start(self):
+        self.acceptThread.start()
+        self.sendThread.start()
+
+    def Update(self, timestamp):
+        """ Sampler listener, queues the newest value of every column """
+        row = np.array([metricValue(device, name) for device, name in self.columns], dtype=np.float32)
+        with self.lock:
+            self.timestamps.append(timestamp)
+            self.rows.append(row)
+
+    def accept(self):
+        while not self.stopEvent.is_set():
+            try:
+                client, address = self.server.accept()
+            except OSError:
+                return
+            client.settimeout(SEND_TIMEOUT)
+            client.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            try:
+                client.sendall(AGENT_MAGIC)
+                sendFrame(client, self.header)
+            except OSError:
+                client.close()
+                continue
+            with self.lock:
+                # The keyframe is sent by the send thread, ahead of the next batch
+                self.clients.append([client, True])
+
+    def send(self):
+        while not self.stopEvent.wait(BATCH_SECONDS):
+            with self.lock:
+                timestamps, rows = self.timestamps, self.rows
+                self.timestamps, self.rows = [], []
+                clients = list(self.clients)
+            if not rows:
+                continue
+            rows = np.vstack(rows)
+            timestamps = np.array(timestamps, dtype=np.float64)
+            keyframe = None
+            if self.last is not None and any(client[1] for client in clients):
+                keyframe = encodeBatch(np.array([self.lastTimestamp]), self.last[None, :], None)
+            batch = encodeBatch(timestamps, rows, self.last)
+            fullBatch = None
+            self.last = rows[-1]
+            self.lastTimestamp = timestamps[-1]
+
+            for client in clients:
+                try:
+                    if client[1]:
+                        if keyframe:
+                            sendFrame(client[0], keyframe)
+                            sendFrame(client[0], batch)
+                        else:
+                            # First batch ever sent, nothing to be relative to
+                            if fullBatch is None:
+                                fullBatch = encodeBatch(timestamps, rows, None)
+                            sendFrame(client[0], fullBatch)
+                        client[1] = False
+                    else:
+                        sendFrame(client[0], batch)
+                except OSError:
+                    client[0].close()
+                    with self.lock:
+                        self.clients.remove(client)
+
+    def Close(self):
+        self.stopEvent.set()
+        self.server.close()
+        with self.lock:
+            for client in self.clients:
+                client[0].close()
+            self.clients = []
+
+
+class NodeDevice:
+    """ Device of a remote node, every metric kept as a RingBuffer """
+    def __init__(self, description, history):
+        self.name = description['name']
+        self.type = description['type']
+        self.METRICS = description['metrics']
+        for name in self.METRICS:
+            setattr(self, name, RingBuffer(history))
+
+
+class ClusterNode(threading.Thread):
+    """ Connection to the agent of one node, filling the histories of its devices
+
+    Parameters:
+    view -- ClusterView notified when samples arrive
+    address -- host or host:port of the agent
+    history -- Number of samples kept for each metric
+    """
+    def __init__(self, view, address, history):
+        threading.Thread.__init__(self, name='aiz-cluster-%s' % address, daemon=True)
+        self.view = view
+        host, _, port = address.partition(':')
+        self.host = host
+        self.port = int(port) if port else AGENT_PORT
+        self.history = history
+        self.devices = []
+        self.connected = False
+        self.lastSample = 0.0
+
+    def connect(self):
+        sock = socket.create_connection((self.host, self.port), timeout=RECONNECT_SECONDS)
+        if receiveExactly(sock, len(AGENT_MAGIC)) != AGENT_MAGIC:
+            raise ConnectionError('%s is not an ai-z agent' % self.host)
+        header = json.loads(receiveFrame(sock).decode())
+        # Batches only go out once a sample was taken, slow agents get longer
+        sock.settimeout(RECEIVE_BATCHES * max(BATCH_SECONDS, float(header.get('interval') or 0)))
+        devices = [NodeDevice(description, self.history) for description in header['devices']]
+        # Columns in record order, as (history) of the device metrics
+        self.columns = [getattr(device, name) for device in devices for name in device.METRICS]
+        self.devices = devices
+        return sock
+
+    def run(self):
+        while True:
+            sock = None
+            try:
+                sock = self.connect()
+                self.connected = True
+                self.view.generation += 1
+                previous = None
+                while True:
+                    timestamps, rows = decodeBatch(receiveFrame(sock), previous)
+                    previous = rows[-1]
+                    for i in range(0, len(self.columns)):
+                        self.columns[i].Extend(rows[:, i])
+                    self.lastSample = timestamps[-1]
+                    self.view.generation += 1
+            except Exception as e:
+                # Timeouts, closed connections, and truncated or corrupt frames and headers
+                logging.debug('%s: %s', self.name, e)
+            if sock:
+                sock.close()
+            self.connected = False
+            self.view.generation += 1
+            time.sleep(RECONNECT_SECONDS)
+
+    def GpuDevices(self):
+        return [device for device in self.devices if device.type != 'AIZCPU']
+
+    def CpuDevice(self):
+        for device in self.devices:
+            if device.type == 'AIZCPU':
+                return device
+        return None
+
+
+class ClusterView:
+    """ Aggregated view of several agents, drawn by DisplayCluster()
+
+    Has the Sampler interface of the main loop, and scrolls with the up
+    and down keys when the nodes don't fit the terminal.
+
+    Parameters:
+    addresses -- List of host or host:port agent addresses
+    history -- Number of samples kept for each metric
+    """
+    def __init__(self, addresses, history):
+        self.generation = 0
+        self.error = None
+        self.scroll = 0
+        self.nodes = [ClusterNode(self, address, history) for address in addresses]
+        for node in self.nodes:
+            node.start()
+
+    def HandleKey(self, key, width):
+        if key == curses.KEY_DOWN:
+            self.scroll += 1
+        elif key == curses.KEY_UP:
+            self.scroll = max(0, self.scroll - 1)
+        elif key == curses.KEY_NPAGE:
+            self.scroll += 10
+        elif key == curses.KEY_PPAGE:
+            self.scroll = max(0, self.scroll - 10)
+        else:
+            return False
+        self.generation += 1
+        return True
+
+    def Status(self):
+        connected = sum(1 for node in self.nodes if node.connected)
+        gpus = sum(len(node.GpuDevices()) for node in self.nodes)
+        return '%d/%d nodes, %d GPUs  up/down:Scroll' % (connected, len(self.nodes), gpus)
@@ -0,0 +1,201 @@
+#=============================================
+# Container awareness: CPU and memory accounting from the cgroup v2 the
+# process runs in, and the GPUs a container is allowed to use.
+#=============================================
+
+import os
+import glob
+import time
+from aiz.sysfs import SysfsFile
+
+
+cgroupprefix = '/sys/fs/cgroup'
+procgroup = '/proc/self/cgroup'
+devprefix = '/dev/dri'
+
+# Minimum time between two reads of the CPU quota and memory limit, they rarely change
+LIMIT_INTERVAL = 1.0
+
+
+def findCgroup():
+    """ Return the cgroup v2 directory of the process, None on cgroup v1 or without /proc """
+    try:
+        with open(procgroup, 'r') as f:
+            lines = f.read().splitlines()
+    except OSError:
+        return None
+    for line in lines:
+        hierarchy, _, rest = line.partition(':')
+        controllers, _, path = rest.partition(':')
+        # The unified hierarchy is the only one with id 0 and no controller list
+        if hierarchy == '0' and controllers == '':
+            directory = os.path.join(cgroupprefix, path.lstrip('/'))
+            if os.path.isfile(os.path.join(directory, 'cpu.stat')):
+                return directory
+    return None
+
+def parseKeyedFile(text):
+    """ Return {key: int} of a flat keyed file like cpu.stat """
+    values = {}
+    for line in text.splitlines():
+        key, _, value = line.partition(' ')
+        if value.strip().isdigit():
+            values[key] = int(value)
+    return values
+
+def parseCpuMax(text):
+    """ Return the CPU quota of a cpu.max file in CPUs, None without a quota """
+    quota, _, period = text.strip().partition(' ')
+    if quota == 'max' or not quota.isdigit() or not period.strip().isdigit() or int(period) == 0:
+        return None
+    return float(quota) / float(period)
+
+def parsePressure(text):
+    """ Return the 'some avg10' of a PSI file, the % of the last 10 s some task was stalled """
+    for line in text.splitlines():
+        if line.startswith('some '):
+            for field in line.split()[1:]:
+                key, _, value = field.partition('=')
+                if key == 'avg10':
+                    return float(value)
+    return 0.0
+
+
+class CgroupStats:
+    """ CPU, memory and pressure of a cgroup v2, relative to its limits
+
+    Every file is opened once and re-read with pread. CPU usage is the
+    usage_usec delta against the CPU quota, the tightest one of the cgroup
+    and its ancestors, or against the CPUs the process may run on without
+    a quota. Throttling is the share of CFS periods that hit the quota.
+
+    Parameters:
+    path -- cgroup v2 directory, from findCgroup()
+    """
+    def __init__(self, path):
+        self.path = path
+        self.cpuStat = self.open('cpu.stat')
+        self.memoryCurrent = self.open('memory.current')
+        self.cpuPressure = self.open('cpu.pressure')
+        self.memoryPressure = self.open('memory.pressure')
+        # Limits of the cgroup and its ancestors, up to the root of the hierarchy
+        self.cpuMax = []
+        self.memoryMax = []
+        directory = path
+        while True:
+            for name, files in [('cpu.max', self.cpuMax), ('memory.max', self.memoryMax)]:
+                limit = self.open(name, directory)
+                if limit:
+                    files.append(limit)
+            if os.path.normpath(directory) == os.path.normpath(cgroupprefix) or directory in ('', '/'):
+                break
+            directory = os.path.dirname(directory)
+        self.lastLimits = 0.0
+        self.cpus = 0.0
+        self.memoryLimit = None
+        self.readLimits()
+        self.previous = None
+
+    def open(self, name, directory=None):
+        try:
+            return SysfsFile(os.path.join(directory or self.path, name))
+        except OSError:
+            return None
+
+    def readLimits(self):
+        self.lastLimits = time.monotonic()
+        quotas = [parseCpuMax(limit.Read()) for limit in self.cpuMax]
+        quotas = [quota for quota in quotas if quota]
+        allowed = len(os.sched_getaffinity(0)) if hasattr(os, 'sched_getaffinity') else (os.cpu_count() or 1)
+        self.cpus = min(quotas + [float(allowed)])
+        limits = [limit.Read().strip() for limit in self.memoryMax]
+        limits = [int(limit) for limit in limits if limit.isdigit()]
+        self.memoryLimit = min(limits) if limits else None
+
+    def HasLimits(self, hostCpus):
+        """ Return whether the cgroup is held to less CPU or memory than the host has """
+        return self.memoryLimit is not None or self.cpus < hostCpus
+
+    def Read(self):
+        """ Return (cpu % of the quota, % of CFS periods throttled, memory % of the limit or None, cpu PSI %, memory PSI %) """
+        now = time.monotonic()
+        if now - self.lastLimits >= LIMIT_INTERVAL:
+            self.readLimits()
+        stat = parseKeyedFile(self.cpuStat.Read()) if self.cpuStat else {}
+        current = (now, stat.get('usage_usec', 0), stat.get('nr_periods', 0), stat.get('nr_throttled', 0))
+        previous = self.previous
+        self.previous = current
+        cpuUsage = 0.0
+        throttled = 0.0
+        if previous and current[0] > previous[0]:
+            cpuUsage = min(100.0, 100.0 * (current[1] - previous[1]) / 1e6 / (current[0] - previous[0]) / max(0.01, self.cpus))
+            periods = current[2] - previous[2]
+            if periods > 0:
+                throttled = 100.0 * (current[3] - previous[3]) / periods
+        memoryUsage = None
+        if self.memoryCurrent and self.memoryLimit:
+            memoryUsage = min(100.0, 100.0 * int(self.memoryCurrent.Read()) / self.memoryLimit)
+        cpuPressure = parsePressure(self.cpuPressure.Read()) if self.cpuPressure else 0.0
+        memoryPressure = parsePressure(self.memoryPressure.Read()) if self.memoryPressure else 0.0
+        return (cpuUsage, throttled, memoryUsage, cpuPressure, memoryPressure)
+
+    def Close(self):
+        for sysfsFile in [self.cpuStat, self.memoryCurrent, self.cpuPressure, self.memoryPressure] + self.cpuMax + self.memoryMax:
+            if sysfsFile:
+                sysfsFile.Close()
+
+
+def inContainer():
+    """ Return whether the process runs in a Docker, Podman or Kubernetes container """
+    return (os.path.exists('/.dockerenv') or os.path.exists('/run/.containerenv') or
+            'KUBERNETES_SERVICE_HOST' in os.environ)
+
+def visibleDevices(variables):
+    """ Return the entries of the first set *_VISIBLE_DEVICES variable, None when none is set
+
+    Entries are GPU indices as ints, or identifiers like 'GPU-8932f937' as
+    strings. An empty variable hides every GPU, like it does for CUDA.
+
+    Parameters:
+    variables -- Environment variable names, in order of precedence
+    """
+    for variable in variables:
+        value = os.environ.get(variable)
+        if value is None:
+            continue
+        entries = []
+        for entry in value.split(','):
+            entry = entry.strip()
+            if entry:
+                entries.append(int(entry) if entry.isdigit() else entry)
+        return entries
+    return None
+
+def isVisible(index, identifier, visible):
+    """ Return whether a GPU is listed by visibleDevices(), identifiers match by prefix like CUDA does
+
+    Parameters:
+    index -- Position of the GPU in its backend
+    identifier -- UUID of the GPU, or None if unknown
+    visible -- Result of visibleDevices()
+    """
+    if visible is None:
+        return True
+    for entry in visible:
+        if entry == index:
+            return True
+        if identifier and isinstance(entry, str) and identifier.lower().startswith(entry.lower()):
+            return True
+    return False
+
+def hasRenderNode(devicePath):
+    """ Return whether the render node of a DRM card exists in /dev/dri, containers only get the GPUs they may use
+
+    Parameters:
+    devicePath -- The card device directory, like /sys/class/drm/card0/device
+    """
+    nodes = glob.glob(os.path.join(devicePath, 'drm', 'renderD*'))
+    if not nodes:
+        # Nothing to check against, display-only or very old kernels
+        return True
+    return any(os.path.exists(os.path.join(devprefix, os.path.basename(node))) for node in nodes)
@@ -1,30 +1,173 @@
-from cpuinfo import get_cpu_info
+import os
+import glob
 import psutil
+from aiz.history import RingBuffer, DEFAULT_HISTORY
+from aiz.sysfs import SysfsFile
+from aiz.instrument import SampleTimer
+from aiz.container import findCgroup, CgroupStats
+
+
+nodeprefix = '/sys/devices/system/node'
+cpuprefix = '/sys/devices/system/cpu'
+meminfopath = '/proc/meminfo'
+
+
+def parseMeminfo(text):
+    """ Return (RAM used %, swap used %) from the contents of /proc/meminfo """
+    fields = {}
+    for line in text.splitlines():
+        key, _, value = line.partition(':')
+        if key in ('MemTotal', 'MemAvailable', 'SwapTotal', 'SwapFree'):
+            fields[key] = int(value.split()[0])
+    memTotal = fields.get('MemTotal', 0)
+    swapTotal = fields.get('SwapTotal', 0)
+    memUsage = 100.0 * (memTotal - fields.get('MemAvailable', memTotal)) / memTotal if memTotal else 0.0
+    swapUsage = 100.0 * (swapTotal - fields.get('SwapFree', swapTotal)) / swapTotal if swapTotal else 0.0
+    return (memUsage, swapUsage)
+
+def readCpuName():
+    """ Return the brand string of the cpu
+
+    /proc/cpuinfo has it on x86. py-cpuinfo is only imported for the other
+    architectures, it can take seconds and runs subprocesses.
+    """
+    try:
+        with open('/proc/cpuinfo', 'r') as cpuinfo:
+            for line in cpuinfo:
+                if line.startswith('model name'):
+                    return line.partition(':')[2].strip()
+    except OSError:
+        pass
+    try:
+        from cpuinfo import get_cpu_info
+        info = get_cpu_info()
+    except Exception:
+        return 'CPU'
+    return info.get('brand_raw', info.get('brand', 'CPU'))
+
+def readCpuList(path):
+    """ Return the cpus of a sysfs cpu list like '0-7,64-71', empty if it can't be read """
+    cpus = []
+    try:
+        with open(path, 'r') as cpulist:
+            text = cpulist.read().strip()
+    except OSError:
+        return cpus
+    for part in text.split(','):
+        if not part:
+            continue
+        first, _, last = part.partition('-')
+        cpus.extend(range(int(first), int(last or first) + 1))
+    return cpus
+
+def getCpuGroups(num_threads):
+    """ Return [(NUMA node, [[cpu, ...], ...])], the cpus of each node grouped by shared L3 (CCX)
+
+    Parameters:
+    num_threads -- Number of logical cpus, groups only hold cpus below it
+    """
+    nodes = []
+    for path in glob.glob(os.path.join(nodeprefix, 'node[0-9]*')):
+        cpus = [cpu for cpu in readCpuList(os.path.join(path, 'cpulist')) if cpu < num_threads]
+        if cpus:
+            nodes.append((int(os.path.basename(path)[4:]), cpus))
+    if not nodes:
+        nodes = [(0, list(range(0, num_threads)))]
+    nodes.sort()
+
+    groups = []
+    for node, cpus in nodes:
+        caches = {}
+        for cpu in cpus:
+            shared = readCpuList(os.path.join(cpuprefix, 'cpu%d' % cpu, 'cache', 'index3', 'shared_cpu_list'))
+            key = tuple(sorted(set(shared) & set(cpus))) or (node,)
+            caches.setdefault(key, []).append(cpu)
+        groups.append((node, sorted(caches.values())))
+    return groups
 
 
 class AIZCPU:
-    def __init__(self):
-        self.name = 'CPU'
-        for key, value in get_cpu_info().items():
-            if key == 'brand':
-                self.name = value.replace('(R)','')
-                self.name = self.name.replace('(TM)','')
-                self.name = self.name.replace('CPU','')
-                self.name = self.name.replace('  @ ','@')
-                #self.cpu.name = self.cpu.name('(TM)','')
-                break
+    # Recorded metrics, histories or plain values
+    METRICS = ['cpu_usage', 'mem_usage', 'swap_usage']
+    # Recorded as well inside a cgroup: % of CFS periods throttled, CPU and memory PSI some avg10
+    CGROUP_METRICS = ['cpu_throttled', 'cpu_pressure', 'mem_pressure']
+
+    def __init__(self, history=DEFAULT_HISTORY, cgroup=None):
+        """ CPU and host memory, or the CPU quota and memory limit of a cgroup
+
+        Parameters:
+        history -- Number of samples kept for each metric
+        cgroup -- CgroupStats the usage is read from, None for the whole host
+        """
+        self.name = readCpuName()
+        if self.name != 'CPU':
+            self.name = self.name.replace('(R)','')
+            self.name = self.name.replace('(TM)','')
+            self.name = self.name.replace('CPU','')
+            self.name = self.name.replace('  @ ','@')
         self.num_threads = psutil.cpu_count()
-        self.num_cores = self.num_threads / 2
+        self.num_cores = psutil.cpu_count(logical=False) or self.num_threads
+        self.cpu_groups = getCpuGroups(self.num_threads)
         self.memory = float(psutil.virtual_memory().total) / 1024.0 / 1024.0
-        self.MAX_SAMPLES = 100
-        self.cpu_usage = [0] * self.MAX_SAMPLES
-        self.mem_usage = [0] * self.MAX_SAMPLES
+        self.cpu_usage = RingBuffer(history)
+        # Usage of every logical cpu, one row per sample
+        self.core_usage = RingBuffer(history, shape=(self.num_threads,))
+        # Used RAM and swap in %, both from one read of the open /proc/meminfo
+        self.mem_usage = RingBuffer(history)
+        self.swap_usage = RingBuffer(history)
+        try:
+            self.meminfo = SysfsFile(meminfopath, 16384)
+        except OSError:
+            self.meminfo = None
+        self.timer = SampleTimer('cpu')
+        self.cgroup = cgroup
+        if cgroup:
+            self.METRICS = AIZCPU.METRICS + AIZCPU.CGROUP_METRICS
+            self.cpu_throttled = RingBuffer(history)
+            self.cpu_pressure = RingBuffer(history)
+            self.mem_pressure = RingBuffer(history)
+            self.cgroup_cpus = cgroup.cpus
+            if cgroup.memoryLimit:
+                self.memory = min(self.memory, cgroup.memoryLimit / 1024.0 / 1024.0)
 
     def Sample(self):
-        cpuStat = psutil.cpu_percent()
-        self.cpu_usage.append(cpuStat)
-        self.cpu_usage = self.cpu_usage[1:len(self.cpu_usage)]
+        self.timer.Start()
+        coreStats = psutil.cpu_percent(percpu=True)
+        if len(coreStats) == self.num_threads:
+            self.core_usage.Append(coreStats)
+        if self.cgroup:
+            cpuUsage, throttled, cgroupMemUsage, cpuPressure, memPressure = self.cgroup.Read()
+            self.cgroup_cpus = self.cgroup.cpus
+            self.cpu_usage.Append(cpuUsage)
+            self.cpu_throttled.Append(throttled)
+            self.cpu_pressure.Append(cpuPressure)
+            self.mem_pressure.Append(memPressure)
+        else:
+            # Same as psutil.cpu_percent(), without reading /proc/stat a second time
+            self.cpu_usage.Append(sum(coreStats) / max(1, len(coreStats)))
+            cgroupMemUsage = None
+        self.timer.Mark('cpu_usage')
+
+        if self.meminfo:
+            memUsage, swapUsage = parseMeminfo(self.meminfo.Read())
+        else:
+            memUsage, swapUsage = (psutil.virtual_memory().percent, psutil.swap_memory().percent)
+        self.mem_usage.Append(cgroupMemUsage if cgroupMemUsage is not None else memUsage)
+        self.swap_usage.Append(swapUsage)
+        self.timer.Mark('mem_usage')
+
 
+def GetCPUDevice(history=DEFAULT_HISTORY, container=True):
+    """ Return the CPU device, accounted to the cgroup of the process when it is held to a quota or a memory limit
 
-def GetCPUDevice():
-    return AIZCPU()
+    Parameters:
+    history -- Number of samples kept for each metric
+    container -- False always accounts for the whole host
+    """
+    path = findCgroup() if container else None
+    if path:
+        cgroup = CgroupStats(path)
+        if cgroup.HasLimits(psutil.cpu_count() or 1):
+            return AIZCPU(history, cgroup)
+        cgroup.Close()
+    return AIZCPU(history)
@@ -0,0 +1,40 @@
+import os
+import json
+
+
+# Bumped when the stored identity fields change, older caches are ignored
+CACHE_VERSION = 1
+
+
+def cachePath():
+    """ Return the path of the device identity cache, under $XDG_CACHE_HOME or ~/.cache """
+    base = os.environ.get('XDG_CACHE_HOME') or os.path.join(os.path.expanduser('~'), '.cache')
+    return os.path.join(base, 'ai-z', 'devices.json')
+
+def loadDeviceCache():
+    """ Return {bus id: identity dict} of the devices seen by previous runs, empty if there is no usable cache """
+    try:
+        with open(cachePath(), 'r') as f:
+            cache = json.load(f)
+    except (OSError, ValueError):
+        return {}
+    if not isinstance(cache, dict) or cache.get('version') != CACHE_VERSION:
+        return {}
+    return cache.get('devices', {})
+
+def saveDeviceCache(devices):
+    """ Write the device identities for the next runs, failures only cost the next startup a lookup
+
+    Parameters:
+    devices -- {bus id: identity dict}
+    """
+    path = cachePath()
+    try:
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        temp = '%s.%d' % (path, os.getpid())
+        with open(temp, 'w') as f:
+            json.dump({'version' : CACHE_VERSION, 'devices' : devices}, f, indent=1, sort_keys=True)
+        # Concurrent runs each replace the whole file, readers never see a partial one
+        os.replace(temp, path)
+    except OSError:
+        pass
@@ -0,0 +1,121 @@
+import threading
+import time
+from http.server import HTTPServer, BaseHTTPRequestHandler
+from socketserver import ThreadingMixIn
+from aiz.history import metricValue
+
+
+# Prometheus name and help of the device metrics, others are exported as aiz_<metric>
+METRIC_INFO = {
+    'gpu_usage' : ('aiz_gpu_usage_percent', 'GPU utilization'),
+    'vram_usage' : ('aiz_gpu_vram_usage_percent', 'Used VRAM'),
+    'mem_busy' : ('aiz_gpu_memory_busy_percent', 'Time the GPU memory controller was busy'),
+    'pcie_bw' : ('aiz_gpu_pcie_bandwidth_mbytes_per_second', 'PCIe throughput, both directions'),
+    'pcie_tx' : ('aiz_gpu_pcie_tx_percent', 'PCIe transmit throughput, percent of the link bandwidth'),
+    'pcie_rx' : ('aiz_gpu_pcie_rx_percent', 'PCIe receive throughput, percent of the link bandwidth'),
+    'temp' : ('aiz_gpu_temperature_celsius', 'GPU temperature'),
+    'fan' : ('aiz_gpu_fan_percent', 'GPU fan speed'),
+    'gpu_clock' : ('aiz_gpu_clock_percent', 'Graphics clock, percent of the maximum'),
+    'mem_clock' : ('aiz_gpu_memory_clock_percent', 'Memory clock, percent of the maximum'),
+    'power' : ('aiz_gpu_power_percent', 'Power draw, percent of the power cap'),
+    'gpu_clock_mhz' : ('aiz_gpu_clock_mhz', 'Graphics clock'),
+    'mem_clock_mhz' : ('aiz_gpu_memory_clock_mhz', 'Memory clock'),
+    'power_watts' : ('aiz_gpu_power_watts', 'Power draw'),
+    'power_cap' : ('aiz_gpu_power_cap_watts', 'Power cap'),
+    'throttle' : ('aiz_gpu_throttle_reasons', 'Clock throttle reasons, NVML bitmask'),
+    'sm_active' : ('aiz_gpu_sm_active_percent', 'Time the SMs had at least one warp, DCGM'),
+    'sm_occupancy' : ('aiz_gpu_sm_occupancy_percent', 'Resident warps against the SM maximum, DCGM'),
+    'tensor_active' : ('aiz_gpu_tensor_active_percent', 'Time the tensor pipes were busy, DCGM'),
+    'dram_active' : ('aiz_gpu_dram_active_percent', 'Time the memory interface was busy, DCGM'),
+    'nvlink_tx' : ('aiz_gpu_nvlink_tx_mbytes_per_second', 'NVLink transmit throughput, DCGM'),
+    'nvlink_rx' : ('aiz_gpu_nvlink_rx_mbytes_per_second', 'NVLink receive throughput, DCGM'),
+    'interconnect_bw' : ('aiz_gpu_interconnect_mbytes_per_second', 'NVLink or XGMI throughput of every link, both directions'),
+    'cpu_usage' : ('aiz_cpu_usage_percent', 'CPU utilization'),
+    'mem_usage' : ('aiz_host_memory_usage_percent', 'Used host RAM'),
+    'swap_usage' : ('aiz_host_swap_usage_percent', 'Used swap'),
+    'cpu_throttled' : ('aiz_cgroup_cpu_throttled_percent', 'CFS periods throttled by the cgroup CPU quota'),
+    'cpu_pressure' : ('aiz_cgroup_cpu_pressure_percent', 'Time some task of the cgroup waited for a CPU, last 10 s'),
+    'mem_pressure' : ('aiz_cgroup_memory_pressure_percent', 'Time some task of the cgroup waited for memory, last 10 s'),
+}
+
+# Minimum time between two rebuilds of the response, scrapes in between get the same bytes
+REFRESH_SECONDS = 1.0
+
+
+class ThreadingHTTPServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+
+def escapeLabel(value):
+    return value.replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n')
+
+
+class MetricsExporter:
+    """ Prometheus text format endpoint serving the metrics collected by the sampler
+
+    The sampler thread rebuilds the whole response at most every
+    REFRESH_SECONDS, and scrapes only write the last built bytes, so any
+    number of collectors can scrape without triggering a hardware read.
+
+    Parameters:
+    port -- TCP port to listen on, on every interface
+    gpus -- GPU devices found by DetectHardware()
+    cpu -- CPU device found by DetectHardware()
+    """
+    def __init__(self, port, gpus, cpu):
+        # Families of (metric name, header bytes, [(sample prefix, device, attribute)])
+        self.families = []
+        families = {}
+        devices = [(gpus[i], 'gpu="%d",name="%s"' % (i, escapeLabel(gpus[i].name))) for i in range(0, len(gpus))]
+        devices.append((cpu, 'name="%s"' % escapeLabel(cpu.name)))
+        for device, labels in devices:
+            for attribute in device.METRICS:
+                name, description = METRIC_INFO.get(attribute, ('aiz_' + attribute, attribute))
+                if name not in families:
+                    families[name] = (name, ('# HELP %s %s\n# TYPE %s gauge\n' % (name, description, name)).encode(), [])
+                    self.families.append(families[name])
+                families[name][2].append(('%s{%s} ' % (name, labels), device, attribute))
+
+        self.body = b''
+        self.lastBuild = 0.0
+        self.Build()
+
+        exporter = self
+        class Handler(BaseHTTPRequestHandler):
+            def do_GET(self):
+                if self.path not in ('/', '/metrics'):
+                    self.send_error(404)
+                    return
+                body = exporter.body
+                self.send_response(200)
+                self.send_header('Content-Type', 'text/plain; version=0.0.4; charset=utf-8')
+                self.send_header('Content-Length', str(len(body)))
+                self.end_headers()
+                self.wfile.write(body)
+
+            def log_message(self, format, *args):
+                pass
+
+        self.server = ThreadingHTTPServer(('', port), Handler)
+        self.thread = threading.Thread(target=self.server.serve_forever, name='aiz-exporter', daemon=True)
+
+    def Build(self):
+        parts = []
+        for name, header, samples in self.families:
+            parts.append(header)
+            parts.append(''.join('%s%g\n' % (prefix, metricValue(device, attribute)) for prefix, device, attribute in samples).encode())
+        # A single reference swap, scrapes see either the old or the new response
+        self.body = b''.join(parts)
+        self.lastBuild = time.monotonic()
+
+    def Update(self, timestamp):
+        """ Sampler listener, rebuilds the response when it is old enough """
+        if time.monotonic() - self.lastBuild >= REFRESH_SECONDS:
+            self.Build()
+
+    def Start(self):
+        self.thread.start()
+
+    def Close(self):
+        self.server.shutdown()
+        self.server.server_close()
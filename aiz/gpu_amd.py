@@ -6,7 +6,17 @@
 
 import os
 import re
+import errno
 import logging
+from aiz.sysfs import SysfsFile
+from aiz.history import RingBuffer, DEFAULT_HISTORY
+from aiz.pcie import pcieLinkBandwidth, pcieGenFromSpeed, pciePercent, normalizeBusId, pciDeviceName
+from aiz.worker import AsyncReader
+from aiz.instrument import SampleTimer
+from aiz.throttle import THROTTLE_SW_POWER_CAP, THROTTLE_SW_THERMAL, clockPercent
+from aiz.amd_metrics import GPU_METRICS_SIZE, decodeGpuMetrics
+from aiz.container import isVisible, hasRenderNode
+from aiz.interconnect import LinkCounters
 
 
 
@@ -17,6 +27,15 @@ debugprefix = '/sys/kernel/debug/dri'
 moduleprefix = '/sys/module'
 kfdprefix = '/sys/class/kfd/kfd'
 
+# Read errors returned by open sysfs files once their device is gone
+staleErrnos = {errno.ENODEV, errno.ENOENT, errno.EBADF}
+
+# Cost classes of the valuePaths entries. Reading a slow value blocks, they are
+# read on a separate thread every SLOW_INTERVAL and sampled from the last result
+COST_FAST = 'fast'
+COST_SLOW = 'slow'
+SLOW_INTERVAL = 1.0
+
 
 # Supported firmware blocks
 validFwBlocks = {'vce', 'uvd', 'mc', 'me', 'pfp',
@@ -33,17 +52,23 @@ valuePaths = {
     'mclk_od' : {'prefix' : drmprefix, 'filepath' : 'pp_mclk_od', 'needsparse' : False},
     'dcefclk' : {'prefix' : drmprefix, 'filepath' : 'pp_dpm_dcefclk', 'needsparse' : False},
     'fclk' : {'prefix' : drmprefix, 'filepath' : 'pp_dpm_fclk', 'needsparse' : False},
-    'mclk' : {'prefix' : drmprefix, 'filepath' : 'pp_dpm_mclk', 'needsparse' : False},
+    # DPM levels and power are SMU firmware queries, a read can take milliseconds
+    'mclk' : {'prefix' : drmprefix, 'filepath' : 'pp_dpm_mclk', 'needsparse' : False, 'cost' : COST_SLOW},
     'pcie' : {'prefix' : drmprefix, 'filepath' : 'pp_dpm_pcie', 'needsparse' : False},
-    'sclk' : {'prefix' : drmprefix, 'filepath' : 'pp_dpm_sclk', 'needsparse' : False},
+    'sclk' : {'prefix' : drmprefix, 'filepath' : 'pp_dpm_sclk', 'needsparse' : False, 'cost' : COST_SLOW},
     'socclk' : {'prefix' : drmprefix, 'filepath' : 'pp_dpm_socclk', 'needsparse' : False},
     'clk_voltage' : {'prefix' : drmprefix, 'filepath' : 'pp_od_clk_voltage', 'needsparse' : False},
     'voltage' : {'prefix' : hwmonprefix, 'filepath' : 'in0_input', 'needsparse' : False},
     'profile' : {'prefix' : drmprefix, 'filepath' : 'pp_power_profile_mode', 'needsparse' : False},
     'use' : {'prefix' : drmprefix, 'filepath' : 'gpu_busy_percent', 'needsparse' : False},
     'use_mem' : {'prefix' : drmprefix, 'filepath' : 'mem_busy_percent', 'needsparse' : False},
-    'pcie_bw' : {'prefix' : drmprefix, 'filepath' : 'pcie_bw', 'needsparse' : False},
+    # Binary table of activity, temperatures, clocks, power and throttle status, read with ReadInto()
+    'gpu_metrics' : {'prefix' : drmprefix, 'filepath' : 'gpu_metrics', 'needsparse' : False},
+    # The kernel counts PCIe packets for a whole second before returning
+    'pcie_bw' : {'prefix' : drmprefix, 'filepath' : 'pcie_bw', 'needsparse' : False, 'cost' : COST_SLOW},
     'replay_count' : {'prefix' : drmprefix, 'filepath' : 'pcie_replay_count', 'needsparse' : False},
+    'pcie_speed' : {'prefix' : drmprefix, 'filepath' : 'max_link_speed', 'needsparse' : False},
+    'pcie_width' : {'prefix' : drmprefix, 'filepath' : 'max_link_width', 'needsparse' : False},
     'unique_id' : {'prefix' : drmprefix, 'filepath' : 'unique_id', 'needsparse' : False},
     'serial' : {'prefix' : drmprefix, 'filepath' : 'serial_number', 'needsparse' : False},
     'vendor' : {'prefix' : drmprefix, 'filepath' : 'vendor', 'needsparse' : False},
@@ -53,11 +78,14 @@ valuePaths = {
     'fanmode' : {'prefix' : hwmonprefix, 'filepath' : 'pwm1_enable', 'needsparse' : False},
     'temp1' : {'prefix' : hwmonprefix, 'filepath' : 'temp1_input', 'needsparse' : True},
     'temp1_label' : {'prefix' : hwmonprefix, 'filepath' : 'temp1_label', 'needsparse' : False},
+    'temp1_crit' : {'prefix' : hwmonprefix, 'filepath' : 'temp1_crit', 'needsparse' : True},
     'temp2' : {'prefix' : hwmonprefix, 'filepath' : 'temp2_input', 'needsparse' : True},
     'temp2_label' : {'prefix' : hwmonprefix, 'filepath' : 'temp2_label', 'needsparse' : False},
     'temp3' : {'prefix' : hwmonprefix, 'filepath' : 'temp3_input', 'needsparse' : True},
     'temp3_label' : {'prefix' : hwmonprefix, 'filepath' : 'temp3_label', 'needsparse' : False},
-    'power' : {'prefix' : hwmonprefix, 'filepath' : 'power1_average', 'needsparse' : True},
+    'power' : {'prefix' : hwmonprefix, 'filepath' : 'power1_average', 'needsparse' : True, 'cost' : COST_SLOW},
+    # Newer kernels only expose the instantaneous power on some ASICs
+    'power_input' : {'prefix' : hwmonprefix, 'filepath' : 'power1_input', 'needsparse' : True, 'cost' : COST_SLOW},
     'power_cap' : {'prefix' : hwmonprefix, 'filepath' : 'power1_cap', 'needsparse' : False},
     'power_cap_max' : {'prefix' : hwmonprefix, 'filepath' : 'power1_cap_max', 'needsparse' : False},
     'power_cap_min' : {'prefix' : hwmonprefix, 'filepath' : 'power1_cap_min', 'needsparse' : False},
@@ -104,6 +132,25 @@ for block in validFwBlocks:
 #SMC has different formatting for its version
 valuePaths['smc_fw_version']['needsparse'] = True
 
+def setSysfsPrefixes(drm=None, hwmon=None):
+    """ Read the DRM and HW Monitor trees from other directories, like a fake sysfs for benchmarks
+
+    Parameters:
+    drm -- Replacement for /sys/class/drm, None keeps the current one
+    hwmon -- Replacement for /sys/class/hwmon, None keeps the current one
+    """
+    global drmprefix
+    global hwmonprefix
+    drm = drm or drmprefix
+    hwmon = hwmon or hwmonprefix
+    for pathDict in valuePaths.values():
+        if pathDict['prefix'] == drmprefix:
+            pathDict['prefix'] = drm
+        elif pathDict['prefix'] == hwmonprefix:
+            pathDict['prefix'] = hwmon
+    drmprefix = drm
+    hwmonprefix = hwmon
+
 def listAmdHwMons():
     """Return a list of AMD HW Monitors."""
     hwmons = []
@@ -129,12 +176,21 @@ def getHwmonFromDevice(device):
             return hwmon
     return None
 
-def getFilePath(device, key):
+def valueCost(key):
+    """ Return the cost class of a key, COST_FAST unless its valuePaths entry says otherwise
+
+    Parameters:
+    key -- [$valuePaths.keys()] Key referencing desired SysFS file
+    """
+    return valuePaths[key].get('cost', COST_FAST)
+
+def getFilePath(device, key, hwmon=None):
     """ Return the filepath for a specific device and key
 
     Parameters:
     device -- Device whose filepath will be returned
     key -- [$valuePaths.keys()] The sysfs path to return
+    hwmon -- HW Monitor of the device if already known, looked up otherwise
     """
     if key not in valuePaths.keys():
         print('Cannot get file path for key %s' % key)
@@ -145,10 +201,12 @@ def getFilePath(device, key):
 
     if pathDict['prefix'] == hwmonprefix:
         # HW Monitor values have a different path structure
-        if not getHwmonFromDevice(device):
+        if hwmon is None:
+            hwmon = getHwmonFromDevice(device)
+        if not hwmon:
             logging.warning('GPU[%s]\t: No corresponding HW Monitor found', parseDeviceName(device))
             return None
-        filePath = os.path.join(getHwmonFromDevice(device), pathDict['filepath'])
+        filePath = os.path.join(hwmon, pathDict['filepath'])
     elif pathDict['prefix'] == debugprefix:
         # Kernel DebugFS values have a different path structure
         filePath = os.path.join(pathDict['prefix'], parseDeviceName(device), pathDict['filepath'])
@@ -170,7 +228,6 @@ def getSysfsValue(device, key):
     key -- [$valuePaths.keys()] Key referencing desired SysFS file
     """
     filePath = getFilePath(device, key)
-    pathDict = valuePaths[key]
 
     if not filePath:
         return None
@@ -183,8 +240,18 @@ def getSysfsValue(device, key):
         logging.warning('GPU[%s]\t: Unable to read %s', parseDeviceName(device), filePath)
         return None
 
+    return formatSysfsValue(device, key, fileValue)
+
+def formatSysfsValue(device, key, fileValue):
+    """ Return the SysFS value for a key from the raw contents of its file
+
+    Parameters:
+    device -- DRM device identifier
+    key -- [$valuePaths.keys()] Key referencing desired SysFS file
+    fileValue -- Contents of the SysFS file, without the trailing newline
+    """
     # Some sysfs files aren't a single line of text
-    if pathDict['needsparse']:
+    if valuePaths[key]['needsparse']:
         fileValue = parseSysfsValue(key, fileValue)
 
     if fileValue == '':
@@ -206,7 +273,7 @@ def parseSysfsValue(key, value):
     if re.match(r'temp[0-9]+', key):
         # Convert from millidegrees
         return int(value) / 1000
-    if key == 'power':
+    if key in ['power', 'power_input']:
         # power1_average returns the value in microwatts. However, if power is not
         # available, it will return "Invalid Argument"
         if value.isdigit():
@@ -223,6 +290,26 @@ def parseSysfsValue(key, value):
     return ''
 
 
+def parseDpmClock(value):
+    """ Return (current, maximum) in MHz of a pp_dpm_* level list, (None, None) if it can't be parsed
+
+    The file lists one level per line, like '1: 1800Mhz *', the current one marked with a star.
+
+    Parameters:
+    value -- Contents of the pp_dpm_* file
+    """
+    current = None
+    maximum = None
+    for line in (value or '').splitlines():
+        match = re.match(r'\s*\d+:\s*(\d+)\s*[Mm][Hh]z\s*(\*)?', line)
+        if not match:
+            continue
+        clock = int(match.group(1))
+        maximum = max(maximum or 0, clock)
+        if match.group(2):
+            current = clock
+    return (current, maximum)
+
 def parseDeviceNumber(deviceNum):
     """ Parse the device number, returning the format of card#
     Parameters:
@@ -267,80 +354,398 @@ def getMemInfo(device, memType):
     return (memUsed, memTotal)
 
 
+class AMDSysfsResolver:
+    """ Cached SysFS access for a single DRM device
+
+    The HW Monitor of the device is looked up once, and every file read
+    through Value() is kept open and re-read with pread. Paths are only
+    resolved again when a read fails, which is also what happens to the
+    open files when the device is hot-unplugged or the driver reloaded.
+
+    Parameters:
+    device -- DRM device identifier
+    """
+    def __init__(self, device):
+        self.device = device
+        self.files = {}
+        self.hwmon = None
+        self.timer = SampleTimer('amd')
+        self.Resolve()
+
+    def Resolve(self):
+        """ Drop every cached file and look up the HW Monitor again """
+        self.Close()
+        self.hwmon = getHwmonFromDevice(self.device)
+
+    def Close(self):
+        for sysfsFile in self.files.values():
+            if sysfsFile:
+                sysfsFile.Close()
+        self.files = {}
+
+    def getFile(self, key):
+        """ Return the open SysfsFile for a key, or None if the device doesn't expose it """
+        if key in self.files:
+            return self.files[key]
+        sysfsFile = None
+        filePath = getFilePath(self.device, key, self.hwmon or '')
+        if filePath:
+            try:
+                sysfsFile = SysfsFile(filePath)
+            except OSError:
+                logging.warning('GPU[%s]\t: Unable to open %s', parseDeviceName(self.device), filePath)
+        # Missing files are cached too, so they don't cost a stat on every sample
+        self.files[key] = sysfsFile
+        return sysfsFile
+
+    def Value(self, key):
+        """ Return the desired SysFS value, same as getSysfsValue()
+
+        Parameters:
+        key -- [$valuePaths.keys()] Key referencing desired SysFS file
+        """
+        self.timer.Start()
+        value = self.readValue(key)
+        self.timer.Mark(key)
+        return value
+
+    def readValue(self, key):
+        if key not in valuePaths.keys():
+            logging.debug('Key %s not present in valuePaths map' % key)
+            return None
+
+        for attempt in range(0, 2):
+            sysfsFile = self.getFile(key)
+            if not sysfsFile:
+                return None
+            # Use try since some sysfs files like power1_average will throw -EINVAL
+            # instead of giving something useful.
+            try:
+                fileValue = sysfsFile.Read().rstrip('\n')
+                return formatSysfsValue(self.device, key, fileValue)
+            except OSError as e:
+                # Only a vanished file means the cached paths are stale
+                if attempt > 0 or e.errno not in staleErrnos:
+                    break
+                self.Resolve()
+
+        logging.warning('GPU[%s]\t: Unable to read %s', parseDeviceName(self.device), key)
+        return None
+
+    def ReadInto(self, key, buffer):
+        """ Read a binary SysFS file into a preallocated buffer, returns the number of bytes or None
+
+        Parameters:
+        key -- [$valuePaths.keys()] Key referencing desired SysFS file
+        buffer -- Writable buffer, like a bytearray
+        """
+        self.timer.Start()
+        length = None
+        for attempt in range(0, 2):
+            sysfsFile = self.getFile(key)
+            if not sysfsFile:
+                break
+            try:
+                length = sysfsFile.ReadInto(buffer)
+                break
+            except OSError as e:
+                if attempt > 0 or e.errno not in staleErrnos:
+                    break
+                self.Resolve()
+        self.timer.Mark(key)
+        return length
+
+
 class AIZGPU_AMD:
-    def __init__(self, device_id):
+    # Recorded metrics, histories or plain values
+    METRICS = ['gpu_usage', 'vram_usage', 'mem_busy', 'pcie_bw', 'pcie_tx', 'pcie_rx', 'temp', 'fan',
+               'gpu_clock', 'mem_clock', 'power', 'gpu_clock_mhz', 'mem_clock_mhz', 'power_watts', 'power_cap', 'throttle',
+               'interconnect_bw']
+    # Keys read by Sample()
+    SAMPLED_KEYS = ['perf', 'use', 'use_mem', 'vram_used', 'pcie_bw', 'fan', 'temp1', 'sclk', 'mclk', 'power', 'power_input']
+    # Keys the gpu_metrics table replaces, only read when a field is not reported
+    GPU_METRICS_KEYS = ['use', 'use_mem', 'temp1', 'sclk', 'mclk', 'power', 'power_input']
+
+    def __init__(self, device_id, history=DEFAULT_HISTORY):
         self.device = device_id
-        self.id = getSysfsValue(self.device, 'id')
+        self.sysfs = AMDSysfsResolver(self.device)
+        self.id = self.sysfs.Value('id')
         self.name = device_id # TODO FIX name
-        self.MAX_SAMPLES = 100
-        self.gpu_usage = [0] * self.MAX_SAMPLES
-        self.vram_usage = [0] * self.MAX_SAMPLES
-        self.vram_total = 0
-        self.pcie_bw = [0] * self.MAX_SAMPLES
+        self.bus_id = normalizeBusId(os.path.basename(os.path.realpath(os.path.join(drmprefix, device_id, 'device'))))
+        self.gpu_usage = RingBuffer(history)
+        self.vram_usage = RingBuffer(history)
+        # Time the memory controller was busy, in %, 0 on ASICs without mem_busy_percent
+        self.mem_busy = RingBuffer(history)
+        self.vram_total = self.sysfs.Value('vram_total')
+        # Total PCIe throughput in MB/s, and each direction in % of the link bandwidth
+        self.pcie_bw = RingBuffer(history)
+        self.pcie_tx = RingBuffer(history)
+        self.pcie_rx = RingBuffer(history)
+        self.pcie_gen = pcieGenFromSpeed(self.sysfs.Value('pcie_speed'))
+        self.pcie_width = self.sysfs.Value('pcie_width')
+        self.pcie_link_bw = pcieLinkBandwidth(self.pcie_gen, self.pcie_width)
         self.perf = 0
         self.fan = 0
-        self.fanmax = 0
+        self.fanMax = self.sysfs.Value('fanmax')
         self.temp = 0
+        self.temp_crit = self.sysfs.Value('temp1_crit') or 0
+        # Clocks in % of their highest DPM level, power in % of the cap
+        self.gpu_clock = RingBuffer(history)
+        self.mem_clock = RingBuffer(history)
+        self.power = RingBuffer(history)
+        self.gpu_clock_mhz = 0
+        self.mem_clock_mhz = 0
+        self.power_watts = 0.0
+        # power1_cap is in microwatts
+        powerCap = self.sysfs.Value('power_cap')
+        self.power_cap = float(powerCap) / 1000000.0 if powerCap and powerCap.isdigit() else 0.0
+        # Inferred from the power and temperature, unless gpu_metrics has the status
+        self.throttle = 0
+        # gpu_metrics is read into the same buffer on every sample, None when missing or undecodable
+        self.metricsBuffer = bytearray(GPU_METRICS_SIZE)
+        self.gpuMetrics = None
+        # Set while the table fails to decode, the keys it replaces are then read again
+        self.metricsFailed = False
+        metrics = decodeGpuMetrics(self.metricsBuffer, self.sysfs.ReadInto('gpu_metrics', self.metricsBuffer) or 0)
+        if metrics:
+            self.gpuMetrics = self.metricsBuffer
+            # Clocks are reported in MHz, their highest DPM level only has to be read once
+            self.gpu_clock_max = parseDpmClock(self.sysfs.Value('sclk'))[1]
+            self.mem_clock_max = parseDpmClock(self.sysfs.Value('mclk'))[1]
+        # XGMI links counted by gpu_metrics, tx + rx of each in MB/s and their sum. The table
+        # indexes links by port and the KFD io_links don't say which port reaches which node,
+        # so peers are unknown and the links are only summed, outside the GPU to GPU matrix
+        xgmi = metrics['xgmi'] if metrics else None
+        self.xgmiLinks = [i for i in range(0, len(xgmi)) if xgmi[i] is not None] if xgmi else []
+        self.links = [None] * len(self.xgmiLinks)
+        self.link_bw = RingBuffer(history, shape=(len(self.links),))
+        self.interconnect_bw = RingBuffer(history)
+        self.link_counters = LinkCounters(len(self.links), 1024)
+        # Slow keys get their own resolver, owned by the reader thread. The ones gpu_metrics
+        # replaces stay slow keys, so a table that stops decoding never blocks Sample()
+        self.slowKeys = [key for key in self.SAMPLED_KEYS if valueCost(key) == COST_SLOW]
+        self.slowReader = None
+        if self.slowKeys:
+            self.slowSysfs = AMDSysfsResolver(self.device)
+            self.slowReader = AsyncReader('aiz-amd-slow-%s' % self.device, self.readSlowValues, SLOW_INTERVAL, {})
+            self.slowReader.start()
         self.Sample()
 
     def GetName(self):
         return self.name
 
+    def readSlowValues(self):
+        """ Return the values of every slow key, runs on the reader thread """
+        replaced = self.GPU_METRICS_KEYS if self.gpuMetrics and not self.metricsFailed else []
+        return dict((key, self.slowSysfs.Value(key)) for key in self.slowKeys if key not in replaced)
+
+    def Value(self, key):
+        """ Return a SysFS value, from the last completed read for slow keys
+
+        Parameters:
+        key -- [$valuePaths.keys()] Key referencing desired SysFS file
+        """
+        if key in self.slowKeys:
+            return self.slowReader.value.get(key)
+        return self.sysfs.Value(key)
+
     def Sample(self):
-        self.perf = getSysfsValue(self.device, 'perf')
-        self.fan = getSysfsValue(self.device, 'fan')
-        self.temp = getSysfsValue(self.device, 'fan')
+        self.perf = self.Value('perf')
+
+        metrics = None
+        if self.gpuMetrics:
+            metrics = decodeGpuMetrics(self.gpuMetrics, self.sysfs.ReadInto('gpu_metrics', self.gpuMetrics) or 0)
+            self.metricsFailed = metrics is None
 
         # GPU usage
-        self.gpu_usage.append(int(getSysfsValue(self.device, 'use')))
-        self.gpu_usage = self.gpu_usage[1:len(self.gpu_usage)]
+        if metrics and metrics['gfx_activity'] is not None:
+            self.gpu_usage.Append(min(100, metrics['gfx_activity']))
+        else:
+            self.gpu_usage.Append(int(self.Value('use')))
+        if metrics and metrics['umc_activity'] is not None:
+            self.mem_busy.Append(min(100, metrics['umc_activity']))
+        else:
+            memBusy = self.Value('use_mem')
+            self.mem_busy.Append(int(memBusy) if memBusy else 0)
 
         # VRAM usage
-        memInfo = getMemInfo(self.device, 'vram')
-        mem_use = '% 3.0f' % (100*(float(memInfo[0])/float(memInfo[1])))
-        self.vram_total = memInfo[1]
-        self.vram_usage.append(int(mem_use))
-        self.vram_usage = self.vram_usage[1:len(self.vram_usage)]
+        vram_used = self.Value('vram_used')
+        mem_use = '% 3.0f' % (100*(float(vram_used)/float(self.vram_total)))
+        self.vram_usage.Append(int(mem_use))
 
         # PCIE usage
-        fsvals = getSysfsValue(self.device, 'pcie_bw')
-        # The sysfs file returns 3 integers: bytes-received, bytes-sent, maxsize
-        # Multiply the number of packets by the maxsize to estimate the PCIe usage
-        received = int(fsvals.split()[0])
-        sent = int(fsvals.split()[1])
-        mps = int(fsvals.split()[2])
-        # Use 1024.0 to ensure that the result is a float and not integer division
-        bw = ((received + sent) * mps) / 1024.0 / 1024.0
-        self.pcie_bw.append(float(bw))
-        self.pcie_bw = self.pcie_bw[1:len(self.pcie_bw)]
+        fsvals = self.Value('pcie_bw')
+        if fsvals:
+            # The sysfs file returns 3 integers: bytes-received, bytes-sent, maxsize
+            # Multiply the number of packets by the maxsize to estimate the PCIe usage
+            received = int(fsvals.split()[0])
+            sent = int(fsvals.split()[1])
+            mps = int(fsvals.split()[2])
+            # Use 1024.0 to ensure that the result is a float and not integer division
+            rx = (received * mps) / 1024.0 / 1024.0
+            tx = (sent * mps) / 1024.0 / 1024.0
+            self.pcie_bw.Append(rx + tx)
+            self.pcie_tx.Append(pciePercent(tx, self.pcie_link_bw))
+            self.pcie_rx.Append(pciePercent(rx, self.pcie_link_bw))
+        else:
+            # No read completed yet
+            self.pcie_bw.Append(self.pcie_bw.Latest())
+            self.pcie_tx.Append(self.pcie_tx.Latest())
+            self.pcie_rx.Append(self.pcie_rx.Latest())
+
+        self.sampleLinks(metrics)
 
         # Fan speed %
-        fanLevel = getSysfsValue(self.device, 'fan')
-        self.fanMax = getSysfsValue(self.device, 'fanmax')
+        fanLevel = self.Value('fan')
         if fanLevel and self.fanMax:
             self.fan = (float(fanLevel) / float(self.fanMax)) * 100
             #self.fan = fanLevel
 
+        if metrics:
+            self.sampleGpuMetrics(metrics)
+            return
+
         # Temperature
-        self.temp = getSysfsValue(self.device, 'temp1')
+        self.temp = self.Value('temp1')
+
+        # Clocks
+        self.gpu_clock_mhz, gpuClockMax = parseDpmClock(self.Value('sclk'))
+        self.mem_clock_mhz, memClockMax = parseDpmClock(self.Value('mclk'))
+        self.gpu_clock.Append(clockPercent(self.gpu_clock_mhz, gpuClockMax))
+        self.mem_clock.Append(clockPercent(self.mem_clock_mhz, memClockMax))
+        self.gpu_clock_mhz = self.gpu_clock_mhz or 0
+        self.mem_clock_mhz = self.mem_clock_mhz or 0
+
+        # Power
+        power = self.Value('power')
+        if power == '' or power is None:
+            power = self.Value('power_input')
+        self.power_watts = power if isinstance(power, float) else 0.0
+        self.power.Append(clockPercent(self.power_watts, self.power_cap))
+        self.inferThrottle()
+
+    def sampleGpuMetrics(self, metrics):
+        """ Take the temperature, clocks, power and throttle status from a decoded gpu_metrics table """
+        temp = metrics['temp_edge'] if metrics['temp_edge'] is not None else metrics['temp_hotspot']
+        self.temp = temp if temp is not None else self.Value('temp1')
+
+        self.gpu_clock_mhz = metrics['gfxclk'] or 0
+        self.mem_clock_mhz = metrics['uclk'] or 0
+        self.gpu_clock.Append(clockPercent(self.gpu_clock_mhz, self.gpu_clock_max))
+        self.mem_clock.Append(clockPercent(self.mem_clock_mhz, self.mem_clock_max))
+
+        self.power_watts = float(metrics['socket_power'] or 0)
+        self.power.Append(clockPercent(self.power_watts, self.power_cap))
+
+        if metrics['throttle'] is not None:
+            self.throttle = metrics['throttle']
+        else:
+            self.inferThrottle()
+
+    def sampleLinks(self, metrics):
+        """ Append the XGMI throughput since the previous gpu_metrics table """
+        if not self.links:
+            self.interconnect_bw.Append(0.0)
+            return
+        rates = None
+        if metrics and metrics['xgmi']:
+            rates = self.link_counters.Update([metrics['xgmi'][i] for i in self.xgmiLinks], metrics['timestamp'])
+        self.link_bw.Append(self.link_bw.Latest() if rates is None else rates)
+        self.interconnect_bw.Append(self.link_bw.Latest().sum())
+
+    def inferThrottle(self):
+        # Throttling, within 2% of the power cap or 5 degrees of the critical temperature
+        self.throttle = 0
+        if self.power_cap and self.power_watts >= 0.98 * self.power_cap:
+            self.throttle |= THROTTLE_SW_POWER_CAP
+        if self.temp_crit and self.temp and self.temp >= self.temp_crit - 5:
+            self.throttle |= THROTTLE_SW_THERMAL
+
+
+def readPciId(device):
+    """ Return the 'vendor:device' PCI id of a card, like '0x1002:0x73bf', or '' if unknown
+
+    Parameters:
+    device -- DRM device (cardX)
+    """
+    ids = []
+    for name in ['vendor', 'device']:
+        try:
+            with open(os.path.join(drmprefix, device, 'device', name), 'r') as f:
+                ids.append(f.read().strip())
+        except OSError:
+            return ''
+    return ':'.join(ids)
+
+def getDeviceName(gpu, identities):
+    """ Return the marketing name of a GPU, from the identity cache when it was seen before
 
+    The PCI id database is only scanned for new cards, and the result
+    stored in the cache under the card bus id.
 
-def ListAMDGPUDevices(showall):
+    Parameters:
+    gpu -- AIZGPU_AMD device
+    identities -- Device identity cache, {bus id: {'pci_id', 'name'}}
+    """
+    pciId = readPciId(gpu.device)
+    identity = identities.get(gpu.bus_id)
+    if identity and identity.get('pci_id') == pciId and identity.get('name'):
+        return identity['name']
+    name = None
+    if pciId:
+        vendor, _, device = pciId.partition(':')
+        try:
+            name = pciDeviceName(int(vendor, 16), int(device, 16))
+        except ValueError:
+            name = None
+    # Names look like 'Navi 21 [Radeon RX 6800/6800 XT / 6900 XT]', the brackets hold the products
+    if name and '[' in name and name.endswith(']'):
+        name = name[name.index('[') + 1:-1]
+    name = name or gpu.device
+    identities[gpu.bus_id] = {'pci_id' : pciId, 'name' : name}
+    return name
+
+def isAmdDeviceVisible(index, device, visible, renderNodes):
+    """ Return whether a card is listed by ROCR_VISIBLE_DEVICES, and has a render node when they are checked
+
+    Parameters:
+    index -- Position of the card among the listed cards
+    device -- DRM device (cardX)
+    visible -- Entries from visibleDevices(), None lists every card
+    renderNodes -- Only list cards whose render node exists in /dev/dri
+    """
+    if renderNodes and not hasRenderNode(os.path.join(drmprefix, device, 'device')):
+        return False
+    uuid = None
+    if visible and any(isinstance(entry, str) for entry in visible):
+        # ROCm names GPUs after their unique_id, like GPU-d4a3f2c1b0e9f8a7
+        uniqueId = getSysfsValue(device, 'unique_id')
+        uuid = 'GPU-' + uniqueId if uniqueId else None
+    return isVisible(index, uuid, visible)
+
+def ListAMDGPUDevices(showall, history=DEFAULT_HISTORY, identities=None, visible=None, renderNodes=False):
     """ Return a list of GPU devices.
     Parameters:
     showall -- [True|False] Show all devices, not just AMD devices
+    history -- Number of samples kept for each metric
+    identities -- Device identity cache, updated with the new devices
+    visible -- ROCR_VISIBLE_DEVICES entries from visibleDevices(), None lists every card
+    renderNodes -- Only list cards whose render node exists, sysfs shows every card of the host to a container
     """
 
     if not os.path.isdir(drmprefix) or not os.listdir(drmprefix):
         print('Unable to get devices, /sys/class/drm is empty or missing')
-        return None
+        return []
 
     devicelist = [device for device in os.listdir(drmprefix) if re.match(r'^card\d+$', device) and (isAmdDevice(device) or showall)]
     devicelist_sorted = sorted(devicelist, key=lambda x: int(x.partition('card')[2]))
+    devicelist_sorted = [devicelist_sorted[i] for i in range(0, len(devicelist_sorted))
+                         if isAmdDeviceVisible(i, devicelist_sorted[i], visible, renderNodes)]
 
     gpus = []
     for i in range(0, len(devicelist_sorted)):
-        gpus.append(AIZGPU_AMD(devicelist_sorted[i]))
+        gpus.append(AIZGPU_AMD(devicelist_sorted[i], history))
+        gpus[i].name = getDeviceName(gpus[i], identities if identities is not None else {})
 
     return gpus
 
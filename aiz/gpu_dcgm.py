@@ -0,0 +1,171 @@
+#=============================================
+# DCGM backend: NVIDIA GPUs sampled through NVML like gpu_nvidia.py, plus
+# the DCGM profiling fields that show how busy the SMs, tensor cores, DRAM
+# and NVLink actually are. Only used when the DCGM Python bindings load and
+# a host engine answers, every other NVIDIA setup keeps the NVML backend.
+#=============================================
+
+import os
+import sys
+import time
+import threading
+import logging
+from aiz.history import RingBuffer, DEFAULT_HISTORY
+from aiz.gpu_nvidia import AIZGPU_NVIDIA, ListNVIDIAGPUDevices
+from aiz.pcie import normalizeBusId
+
+
+# Where the DCGM packages install the Python bindings
+DCGM_BINDINGS_PATHS = ['/usr/local/dcgm/bindings/python3', '/usr/share/datacenter-gpu-manager/bindings/python3']
+# Host engine address, nv-hostengine listens on localhost by default
+DCGM_HOST = os.environ.get('AIZ_DCGM_HOST', 'localhost')
+
+# Profiling field ids, from dcgm_fields.h. Activities are ratios in [0, 1], NVLink bytes per second
+DCGM_FI_PROF_SM_ACTIVE = 1002
+DCGM_FI_PROF_SM_OCCUPANCY = 1003
+DCGM_FI_PROF_PIPE_TENSOR_ACTIVE = 1004
+DCGM_FI_PROF_DRAM_ACTIVE = 1005
+DCGM_FI_PROF_NVLINK_TX_BYTES = 1011
+DCGM_FI_PROF_NVLINK_RX_BYTES = 1012
+
+# Attribute -> field id of every watched field
+DCGM_FIELDS = [
+    ('sm_active', DCGM_FI_PROF_SM_ACTIVE),
+    ('sm_occupancy', DCGM_FI_PROF_SM_OCCUPANCY),
+    ('tensor_active', DCGM_FI_PROF_PIPE_TENSOR_ACTIVE),
+    ('dram_active', DCGM_FI_PROF_DRAM_ACTIVE),
+    ('nvlink_tx', DCGM_FI_PROF_NVLINK_TX_BYTES),
+    ('nvlink_rx', DCGM_FI_PROF_NVLINK_RX_BYTES),
+]
+
+# DCGM update interval of the watched fields, the profiling counters can't go much faster
+DCGM_UPDATE_SECONDS = 0.1
+# Values kept by the host engine, only the latest one is read
+DCGM_KEEP_SECONDS = 5.0
+
+
+def importDcgm():
+    """ Return the pydcgm and dcgm_structs modules, or None when DCGM isn't installed """
+    for path in DCGM_BINDINGS_PATHS:
+        if os.path.isdir(path) and path not in sys.path:
+            sys.path.append(path)
+    try:
+        import pydcgm
+        import dcgm_structs
+    except ImportError:
+        return None
+    return (pydcgm, dcgm_structs)
+
+
+class DCGMWatcher:
+    """ DCGM group watching the profiling fields of every GPU at DCGM_UPDATE_SECONDS
+
+    The host engine samples the fields at its own interval and caches them,
+    so reading the latest values is a single request for every GPU. The
+    devices share the last reply, which is only refreshed once per update
+    interval however often and from however many threads they sample.
+
+    Parameters:
+    pydcgm -- pydcgm module
+    dcgm_structs -- dcgm_structs module
+    host -- Host engine address
+    """
+    def __init__(self, pydcgm, dcgm_structs, host=DCGM_HOST):
+        self.handle = pydcgm.DcgmHandle(ipAddress=host, opMode=dcgm_structs.DCGM_OPERATION_MODE_AUTO)
+        discovery = self.handle.GetSystem().discovery
+        # PCI bus id -> DCGM gpu id, DCGM doesn't promise the NVML order
+        self.gpuIds = {}
+        for gpuId in discovery.GetAllSupportedGpuIds():
+            busId = discovery.GetGpuAttributes(gpuId).identifiers.pciBusId
+            self.gpuIds[normalizeBusId(busId)] = gpuId
+        self.group = pydcgm.DcgmGroup(self.handle, groupName='aiz-%d' % os.getpid(), groupType=dcgm_structs.DCGM_GROUP_EMPTY)
+        for gpuId in self.gpuIds.values():
+            self.group.AddGpu(gpuId)
+        self.fieldGroup = pydcgm.DcgmFieldGroup(self.handle, name='aiz-%d' % os.getpid(),
+                                                fieldIds=[fieldId for name, fieldId in DCGM_FIELDS])
+        self.group.samples.WatchFields(self.fieldGroup, int(DCGM_UPDATE_SECONDS * 1000000), DCGM_KEEP_SECONDS, 0)
+        self.lock = threading.Lock()
+        self.values = {}
+        self.lastRead = 0.0
+
+    def GpuId(self, busId):
+        return self.gpuIds.get(busId)
+
+    def Latest(self, gpuId):
+        """ Return {field id: value} of a GPU, without the blank fields """
+        with self.lock:
+            now = time.monotonic()
+            if now - self.lastRead >= DCGM_UPDATE_SECONDS:
+                self.lastRead = now
+                try:
+                    self.values = self.group.samples.GetLatest(self.fieldGroup).values
+                except Exception as e:
+                    logging.debug('dcgm: read failed: %s', e)
+            series = self.values.get(gpuId, {})
+        latest = {}
+        for fieldId, values in series.items():
+            if len(values) and not values[-1].isBlank:
+                latest[fieldId] = values[-1].value
+        return latest
+
+
+class AIZGPU_DCGM(AIZGPU_NVIDIA):
+    """ NVIDIA GPU with the DCGM profiling activities next to the NVML metrics
+
+    NVML gpu_usage is the time any kernel ran, sm_active the time the SMs
+    had work, sm_occupancy the resident warps against the maximum, and
+    tensor_active and dram_active the time the tensor pipes and the memory
+    interface were busy, all in %. nvlink_tx and nvlink_rx are in MB/s.
+
+    Parameters:
+    device_id -- NVML handle
+    history -- Number of samples kept for each metric
+    watcher -- DCGMWatcher shared by the GPUs
+    """
+    METRICS = AIZGPU_NVIDIA.METRICS + ['sm_active', 'sm_occupancy', 'tensor_active', 'dram_active', 'nvlink_tx', 'nvlink_rx']
+
+    def __init__(self, device_id, history=DEFAULT_HISTORY, watcher=None):
+        # Set before the NVML constructor, which takes the first sample
+        self.watcher = watcher
+        self.gpuId = None
+        self.sm_active = RingBuffer(history)
+        self.sm_occupancy = RingBuffer(history)
+        self.tensor_active = RingBuffer(history)
+        self.dram_active = RingBuffer(history)
+        self.nvlink_tx = 0.0
+        self.nvlink_rx = 0.0
+        AIZGPU_NVIDIA.__init__(self, device_id, history)
+        self.gpuId = watcher.GpuId(self.bus_id)
+
+    def Sample(self):
+        AIZGPU_NVIDIA.Sample(self)
+        latest = self.watcher.Latest(self.gpuId) if self.gpuId is not None else {}
+        for name, fieldId in DCGM_FIELDS[:4]:
+            history = getattr(self, name)
+            history.Append(latest[fieldId] * 100.0 if fieldId in latest else history.Latest())
+        if DCGM_FI_PROF_NVLINK_TX_BYTES in latest:
+            self.nvlink_tx = latest[DCGM_FI_PROF_NVLINK_TX_BYTES] / (1024.0 * 1024.0)
+        if DCGM_FI_PROF_NVLINK_RX_BYTES in latest:
+            self.nvlink_rx = latest[DCGM_FI_PROF_NVLINK_RX_BYTES] / (1024.0 * 1024.0)
+        self.timer.Mark('dcgm')
+
+
+def ListDCGMGPUDevices(history=DEFAULT_HISTORY, visible=None):
+    """ Return the NVIDIA GPUs with their DCGM fields, or None when DCGM isn't available
+
+    Parameters:
+    history -- Number of samples kept for each metric
+    visible -- CUDA_VISIBLE_DEVICES entries from visibleDevices(), None lists every GPU
+    """
+    modules = importDcgm()
+    if modules is None:
+        return None
+    try:
+        watcher = DCGMWatcher(*modules)
+    except Exception as e:
+        # No host engine, or profiling isn't supported by this GPU or driver
+        logging.debug('dcgm: unavailable: %s', e)
+        return None
+    if not watcher.gpuIds:
+        return None
+    return ListNVIDIAGPUDevices(history, lambda handle, history: AIZGPU_DCGM(handle, history, watcher), visible)
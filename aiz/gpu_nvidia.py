@@ -1,54 +1,344 @@
+import time
+import threading
+from collections import deque
+from ctypes import cast, c_void_p
 from py3nvml.py3nvml import *
+import py3nvml.py3nvml as nvml
+from aiz.history import RingBuffer, DEFAULT_HISTORY
+from aiz.nvml_fields import NVMLFieldBatch, NVMLProcessUtilization, NVML_FI_DEV_PCIE_COUNT_TX_BYTES, NVML_FI_DEV_PCIE_COUNT_RX_BYTES
+from aiz.nvml_fields import NVML_FI_DEV_POWER_INSTANT
+from aiz.nvml_fields import NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX, NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_RX, NVML_NVLINK_MAX_LINKS
+from aiz.interconnect import LinkCounters
+from aiz.worker import AsyncReader
+from aiz.instrument import SampleTimer
+from aiz.throttle import IDLE_THROTTLE_REASONS, clockPercent
+from aiz.pcie import pcieLinkBandwidth, pciePercent, normalizeBusId
+from aiz.container import isVisible
+
+
+# Time between two nvmlDeviceGetPcieThroughput reads, each one blocks for ~20 ms
+PCIE_INTERVAL = 0.25
+# Time between two reads of the throttle reasons, clock events update them in between
+THROTTLE_INTERVAL = 1.0
+
+# Events kept per device for the timeline
+MAX_EVENTS = 256
+# Longest wait for an NVML event, bounds the time Stop() takes
+EVENT_TIMEOUT_MS = 500
+# Timeline marker of each kind of event
+EVENT_XID = 'X'
+EVENT_THROTTLE = 'T'
+EVENT_CLOCK = 'c'
+EVENT_PSTATE = 'P'
+
+
+def tryNvml(function, *args):
+    """ Return the result of an NVML query, or None when the GPU or driver doesn't support it """
+    try:
+        return function(*args)
+    except NVMLError:
+        return None
+
+def nvlinkPeers(device):
+    """ Return [(NVML link, remote bus id or None)] of the active NVLinks of a GPU, [] without NVLink
+
+    Parameters:
+    device -- NVML handle
+    """
+    # Older py3nvml releases have no NVLink queries
+    getState = getattr(nvml, 'nvmlDeviceGetNvLinkState', None)
+    getRemote = getattr(nvml, 'nvmlDeviceGetNvLinkRemotePciInfo', None)
+    if not getState or not getRemote:
+        return []
+    peers = []
+    for link in range(0, NVML_NVLINK_MAX_LINKS):
+        # NVML_FEATURE_ENABLED, links past the last one of the GPU fail
+        if tryNvml(getState, device, link) != 1:
+            continue
+        remote = tryNvml(getRemote, device, link)
+        peers.append((link, normalizeBusId(remote.busId) if remote else None))
+    return peers
 
 
 class AIZGPU_NVIDIA:
-    def __init__(self, device_id):
+    # Recorded metrics, histories or plain values
+    METRICS = ['gpu_usage', 'vram_usage', 'mem_busy', 'pcie_bw', 'pcie_tx', 'pcie_rx', 'temp', 'fan',
+               'gpu_clock', 'mem_clock', 'power', 'gpu_clock_mhz', 'mem_clock_mhz', 'power_watts', 'power_cap', 'throttle',
+               'interconnect_bw']
+
+    def __init__(self, device_id, history=DEFAULT_HISTORY):
         self.device = device_id
 
         self.name = nvmlDeviceGetName(self.device)
-        self.MAX_SAMPLES = 100
-        self.gpu_usage = [0] * 100
-        self.vram_usage = [0] * self.MAX_SAMPLES
+        self.bus_id = normalizeBusId(nvmlDeviceGetPciInfo(self.device).busId)
+        self.gpu_usage = RingBuffer(history)
+        self.vram_usage = RingBuffer(history)
+        # Time the memory controller was busy, in %
+        self.mem_busy = RingBuffer(history)
         self.vram_total = nvmlDeviceGetMemoryInfo(self.device).total
-        self.pcie_bw = [0] * self.MAX_SAMPLES
+        # Total PCIe throughput in MB/s, and each direction in % of the link bandwidth
+        self.pcie_bw = RingBuffer(history)
+        self.pcie_tx = RingBuffer(history)
+        self.pcie_rx = RingBuffer(history)
         self.pcie_gen = nvmlDeviceGetMaxPcieLinkGeneration(self.device)
         self.pcie_width = nvmlDeviceGetMaxPcieLinkWidth(self.device)
+        self.pcie_link_bw = pcieLinkBandwidth(self.pcie_gen, self.pcie_width)
         self.perf = 0
+        # NVML events as (sample count when received, marker, detail), filled by NVMLEventMonitor
+        self.events = deque(maxlen=MAX_EVENTS)
+        # Clock throttle reasons bitmask, read on clock events and every THROTTLE_INTERVAL
+        self.throttle_reasons = 0
+        self.lastThrottleRead = 0.0
+        self.throttle = 0
+        # Clocks in % of their maximum, power in % of the enforced limit
+        self.gpu_clock = RingBuffer(history)
+        self.mem_clock = RingBuffer(history)
+        self.power = RingBuffer(history)
+        self.gpu_clock_mhz = 0
+        self.mem_clock_mhz = 0
+        self.power_watts = 0.0
+        self.gpu_clock_max = tryNvml(nvmlDeviceGetMaxClockInfo, self.device, NVML_CLOCK_SM) or 0
+        self.mem_clock_max = tryNvml(nvmlDeviceGetMaxClockInfo, self.device, NVML_CLOCK_MEM) or 0
+        # NVML reports milliwatts
+        self.power_cap = (tryNvml(nvmlDeviceGetEnforcedPowerLimit, self.device) or 0) / 1000.0
+        self.hasPower = tryNvml(nvmlDeviceGetPowerUsage, self.device) is not None
+        self.hasThrottle = tryNvml(nvmlDeviceGetCurrentClocksThrottleReasons, self.device) is not None
         self.temp = 0
         self.fan = 0
+        # Metrics available as NVML fields, fetched together at the start of each sample:
+        # the PCIe and NVLink counters and power. nvml.h has no field ids for utilization,
+        # memory info, the GPU temperature, fan speed or the current clocks, so they stay per-call.
+        fields = [
+            ('pcie_tx', NVML_FI_DEV_PCIE_COUNT_TX_BYTES, 0),
+            ('pcie_rx', NVML_FI_DEV_PCIE_COUNT_RX_BYTES, 0),
+            ('power', NVML_FI_DEV_POWER_INSTANT, 0),
+        ]
+        nvlinks = nvlinkPeers(self.device)
+        for link, peer in nvlinks:
+            fields.append(('nvlink_tx_%d' % link, NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX, link))
+            fields.append(('nvlink_rx_%d' % link, NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_RX, link))
+        self.fields = NVMLFieldBatch(self.device, fields)
+        # (tx bytes, rx bytes, timestamp) of the previous counter sample
+        self.pcie_counters = None
+        # Remote bus id of every NVLink with readable counters, tx + rx of each in MB/s, and their sum
+        nvlinks = [(link, peer) for link, peer in nvlinks
+                   if self.fields.Supports('nvlink_tx_%d' % link) and self.fields.Supports('nvlink_rx_%d' % link)]
+        self.links = [peer for link, peer in nvlinks]
+        self.linkFields = [('nvlink_tx_%d' % link, 'nvlink_rx_%d' % link) for link, peer in nvlinks]
+        self.link_bw = RingBuffer(history, shape=(len(self.links),))
+        self.interconnect_bw = RingBuffer(history)
+        self.link_counters = LinkCounters(len(self.links), 1024)
+        self.timer = SampleTimer('nvidia')
+        self.process_utilization = NVMLProcessUtilization(self.device)
+        # Without the byte counters, throughput is measured by NVML over a blocking
+        # window, so it is read on its own thread and sampled from the last result
+        self.pcie_reader = None
+        if not (self.fields.Supports('pcie_tx') and self.fields.Supports('pcie_rx')):
+            index = tryNvml(nvmlDeviceGetIndex, self.device)
+            self.pcie_reader = AsyncReader('aiz-nvidia-pcie-%s' % (index if index is not None else self.bus_id),
+                                           self.readPcieThroughput, PCIE_INTERVAL, (0.0, 0.0))
+            self.pcie_reader.start()
         self.Sample()
 
+    def Processes(self):
+        """ Return [(pid, sm utilization %, used VRAM bytes)] of the compute processes on this GPU """
+        usage = self.process_utilization.Read()
+        processes = []
+        for process in nvmlDeviceGetComputeRunningProcesses(self.device):
+            processes.append((process.pid, usage.get(process.pid, 0), process.usedGpuMemory or 0))
+        return processes
+
+    def AddEvent(self, eventType, eventData):
+        """ Store an NVML event at the current position of the timeline, called by NVMLEventMonitor """
+        if eventType & nvmlEventTypeXidCriticalError:
+            self.events.append((self.gpu_usage.count, EVENT_XID, 'Xid %d' % eventData))
+        elif eventType & nvmlEventTypeClock:
+            try:
+                self.throttle_reasons = nvmlDeviceGetCurrentClocksThrottleReasons(self.device)
+            except NVMLError:
+                self.throttle_reasons = 0
+            if self.throttle_reasons & ~IDLE_THROTTLE_REASONS:
+                self.events.append((self.gpu_usage.count, EVENT_THROTTLE, 'Throttle 0x%x' % self.throttle_reasons))
+            else:
+                self.events.append((self.gpu_usage.count, EVENT_CLOCK, 'Clock change'))
+        elif eventType & nvmlEventTypePState:
+            self.events.append((self.gpu_usage.count, EVENT_PSTATE, 'P-state change'))
+
+    def readPcieThroughput(self):
+        """ Return the PCIe (tx, rx) throughput in MB/s, blocks for the NVML measurement window """
+        tx = nvmlDeviceGetPcieThroughput(self.device, NVML_PCIE_UTIL_TX_BYTES)
+        rx = nvmlDeviceGetPcieThroughput(self.device, NVML_PCIE_UTIL_RX_BYTES)
+        # NVML reports KB/s
+        return (tx / 1024.0, rx / 1024.0)
+
+    def pcieCounterRates(self):
+        """ Return the PCIe (tx, rx) throughput in MB/s since the previous sample of the byte counters,
+        or None if it can't be computed yet """
+        counters = (self.fields.Value('pcie_tx'), self.fields.Value('pcie_rx'), self.fields.Timestamp('pcie_tx'))
+        previous = self.pcie_counters
+        self.pcie_counters = counters
+        if previous is None or None in counters or counters[2] <= previous[2]:
+            return None
+        tx = counters[0] - previous[0]
+        rx = counters[1] - previous[1]
+        if tx < 0 or rx < 0:
+            # A counter wrapped
+            return None
+        seconds = (counters[2] - previous[2]) / 1000000.0
+        return (tx / seconds / (1024.0 * 1024.0), rx / seconds / (1024.0 * 1024.0))
+
+    def sampleLinks(self):
+        """ Append the NVLink throughput since the previous sample of the link counters """
+        if not self.links:
+            self.interconnect_bw.Append(0.0)
+            return
+        counters = []
+        for tx, rx in self.linkFields:
+            txBytes, rxBytes = self.fields.Value(tx), self.fields.Value(rx)
+            counters.append(None if txBytes is None or rxBytes is None else txBytes + rxBytes)
+        rates = self.link_counters.Update(counters, self.fields.Timestamp(self.linkFields[0][0]) / 1000000.0)
+        self.link_bw.Append(self.link_bw.Latest() if rates is None else rates)
+        self.interconnect_bw.Append(self.link_bw.Latest().sum())
+
     def Sample(self):
+        self.timer.Start()
+        self.fields.Fetch()
+        self.timer.Mark('fields')
+
         nv_util = nvmlDeviceGetUtilizationRates(self.device)
-        self.gpu_usage.append(int(nv_util.gpu))
-        self.gpu_usage = self.gpu_usage[1:len(self.gpu_usage)]
+        self.gpu_usage.Append(int(nv_util.gpu))
+        self.mem_busy.Append(int(nv_util.memory))
+        self.timer.Mark('gpu_usage')
+
+        self.vram_usage.Append(nvmlDeviceGetMemoryInfo(self.device).used / float(self.vram_total) * 100)
+        self.timer.Mark('vram_usage')
 
-        self.vram_usage.append(nvmlDeviceGetMemoryInfo(self.device).used / float(self.vram_total) * 100)
-        self.vram_usage = self.vram_usage[1:len(self.vram_usage)]
+        if self.pcie_reader:
+            rates = self.pcie_reader.value
+        else:
+            rates = self.pcieCounterRates()
+        if rates is None:
+            # Keep the previous throughput until two counter samples are apart
+            self.pcie_bw.Append(self.pcie_bw.Latest())
+            self.pcie_tx.Append(self.pcie_tx.Latest())
+            self.pcie_rx.Append(self.pcie_rx.Latest())
+        else:
+            self.pcie_bw.Append(rates[0] + rates[1])
+            self.pcie_tx.Append(pciePercent(rates[0], self.pcie_link_bw))
+            self.pcie_rx.Append(pciePercent(rates[1], self.pcie_link_bw))
+        self.timer.Mark('pcie')
 
-        pcie_usage = nvmlDeviceGetPcieThroughput(self.device, NVML_PCIE_UTIL_TX_BYTES) + nvmlDeviceGetPcieThroughput(self.device, NVML_PCIE_UTIL_RX_BYTES)
-        pcie_usage = pcie_usage / (1024.0)
-        #print(pcie_tx_usage)
-        self.pcie_bw.append(pcie_usage)
-        self.pcie_bw = self.pcie_bw[1:len(self.pcie_bw)]
+        self.sampleLinks()
+        self.timer.Mark('nvlink')
 
         self.temp = nvmlDeviceGetTemperature(self.device, NVML_TEMPERATURE_GPU)
+        self.timer.Mark('temp')
         try:
             self.fan = nvmlDeviceGetFanSpeed(self.device)
         except:
             self.fan = 0
+        self.timer.Mark('fan')
+
+        self.gpu_clock_mhz = tryNvml(nvmlDeviceGetClockInfo, self.device, NVML_CLOCK_SM) or 0
+        self.mem_clock_mhz = tryNvml(nvmlDeviceGetClockInfo, self.device, NVML_CLOCK_MEM) or 0
+        self.gpu_clock.Append(clockPercent(self.gpu_clock_mhz, self.gpu_clock_max))
+        self.mem_clock.Append(clockPercent(self.mem_clock_mhz, self.mem_clock_max))
+        self.timer.Mark('clocks')
+
+        # NVML reports milliwatts, the per-call API is only used without the field
+        power = self.fields.Value('power') if self.fields.Supports('power') else None
+        if power is None and self.hasPower:
+            power = tryNvml(nvmlDeviceGetPowerUsage, self.device)
+        if power is not None:
+            self.power_watts = power / 1000.0
+        self.power.Append(clockPercent(self.power_watts, self.power_cap))
+        self.timer.Mark('power')
+
+        now = time.monotonic()
+        if self.hasThrottle and now - self.lastThrottleRead >= THROTTLE_INTERVAL:
+            self.lastThrottleRead = now
+            self.throttle_reasons = tryNvml(nvmlDeviceGetCurrentClocksThrottleReasons, self.device) or 0
+        self.throttle = self.throttle_reasons & ~IDLE_THROTTLE_REASONS
+        self.timer.Mark('throttle')
+
+
 
+class NVMLEventMonitor(threading.Thread):
+    """ Waits on an NVML event set for Xid errors, clock and P-state changes of every GPU
 
+    Events are received as the driver raises them, so a throttle lasting
+    less than a sampling interval still lands on the timeline, and waiting
+    costs no polling.
 
-def ListNVIDIAGPUDevices():
+    Parameters:
+    gpus -- AIZGPU_NVIDIA devices
+    """
+    def __init__(self, gpus):
+        threading.Thread.__init__(self, name='aiz-nvidia-events', daemon=True)
+        self.stopEvent = threading.Event()
+        self.eventSet = nvmlEventSetCreate()
+        # Device handle address -> gpu, to find the gpu of an event
+        self.gpus = {}
+        wanted = nvmlEventTypeXidCriticalError | nvmlEventTypeClock | nvmlEventTypePState
+        for gpu in gpus:
+            try:
+                eventTypes = nvmlDeviceGetSupportedEventTypes(gpu.device) & wanted
+                if eventTypes:
+                    nvmlDeviceRegisterEvents(gpu.device, eventTypes, self.eventSet)
+                    self.gpus[cast(gpu.device, c_void_p).value] = gpu
+            except NVMLError:
+                pass
 
+    def run(self):
+        while not self.stopEvent.is_set():
+            try:
+                data = nvmlEventSetWait(self.eventSet, EVENT_TIMEOUT_MS)
+            except NVMLError as e:
+                if e.value == NVML_ERROR_TIMEOUT:
+                    continue
+                break
+            gpu = self.gpus.get(cast(data.device, c_void_p).value)
+            if gpu:
+                gpu.AddEvent(data.eventType, data.eventData)
+        nvmlEventSetFree(self.eventSet)
+
+    def Stop(self):
+        self.stopEvent.set()
+
+
+def ListNVIDIAGPUDevices(history=DEFAULT_HISTORY, create=AIZGPU_NVIDIA, visible=None):
+    """ Return a device for every NVML GPU, an empty list without NVML
+
+    Parameters:
+    history -- Number of samples kept for each metric
+    create -- Device constructor called with (NVML handle, history), for backends extending AIZGPU_NVIDIA
+    visible -- CUDA_VISIBLE_DEVICES entries from visibleDevices(), None lists every GPU
+    """
     try:
         nvmlInit()
         num_gpus = nvmlDeviceGetCount()
         gpus = []
         for i in range(0, num_gpus):
-            gpus.append(AIZGPU_NVIDIA(nvmlDeviceGetHandleByIndex(i)))
+            handle = nvmlDeviceGetHandleByIndex(i)
+            uuid = None
+            if visible and any(isinstance(entry, str) for entry in visible):
+                uuid = tryNvml(nvmlDeviceGetUUID, handle)
+                uuid = uuid.decode() if isinstance(uuid, bytes) else uuid
+            # NVML lists every GPU of the host, whatever CUDA is allowed to use
+            if isVisible(i, uuid, visible):
+                gpus.append(create(handle, history))
     except:
         gpus = []
-        
+
+    if gpus:
+        try:
+            monitor = NVMLEventMonitor(gpus)
+            if monitor.gpus:
+                monitor.start()
+            else:
+                nvmlEventSetFree(monitor.eventSet)
+        except NVMLError:
+            # Event sets are not supported on every platform
+            pass
+
     return gpus
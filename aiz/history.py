@@ -0,0 +1,81 @@
+import numpy as np
+
+
+DEFAULT_HISTORY = 100
+
+
+class RingBuffer:
+    """ Fixed capacity history of samples, shared by every device type
+
+    Every value is stored twice, at head and head + capacity, so the newest
+    samples always form one contiguous slice. Append() is O(1) whatever the
+    capacity, and Last() returns a view of the data rather than a copy.
+
+    Parameters:
+    capacity -- Number of samples kept
+    dtype -- numpy type of the samples
+    shape -- Shape of one sample, () for scalars, (n,) for a row of n values
+    """
+    def __init__(self, capacity=DEFAULT_HISTORY, dtype=np.float64, shape=()):
+        self.capacity = capacity
+        self.data = np.zeros((2 * capacity,) + tuple(shape), dtype=dtype)
+        # Next write position, always in [0, capacity)
+        self.head = 0
+        # Total number of samples appended since creation
+        self.count = 0
+
+    def Append(self, value):
+        self.data[self.head] = value
+        self.data[self.head + self.capacity] = value
+        self.head += 1
+        if self.head == self.capacity:
+            self.head = 0
+        self.count += 1
+
+    def Extend(self, values):
+        """ Append several samples at once, oldest first """
+        total = len(values)
+        values = values[-self.capacity:]
+        n = len(values)
+        first = min(n, self.capacity - self.head)
+        self.data[self.head:self.head + first] = values[:first]
+        self.data[self.head + self.capacity:self.head + self.capacity + first] = values[:first]
+        if n > first:
+            self.data[0:n - first] = values[first:]
+            self.data[self.capacity:self.capacity + n - first] = values[first:]
+        self.head = (self.head + n) % self.capacity
+        self.count += total
+
+    def Last(self, n=None):
+        """ Return a view of the newest n samples, oldest first
+
+        Parameters:
+        n -- Number of samples, the whole capacity if None or larger
+        """
+        if n is None or n > self.capacity:
+            n = self.capacity
+        end = self.head + self.capacity
+        return self.data[end - n:end]
+
+    def Latest(self):
+        """ Return the newest sample """
+        return self.data[self.head + self.capacity - 1]
+
+    def __len__(self):
+        return self.capacity
+
+
+def metricValue(device, name):
+    """ Return the newest value of a device metric, whether it has a history or is a plain value
+
+    Parameters:
+    device -- Device object
+    name -- Attribute name of the metric, one of device.METRICS
+    """
+    value = getattr(device, name)
+    if isinstance(value, RingBuffer):
+        return value.Latest()
+    try:
+        return float(value)
+    except (TypeError, ValueError):
+        return 0.0
@@ -3,24 +3,69 @@ import re
 import numpy as np
 from math import sin, pi
 import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
 from aiz.gpu_amd import ListAMDGPUDevices
 from aiz.gpu_nvidia import ListNVIDIAGPUDevices
+from aiz.gpu_dcgm import ListDCGMGPUDevices
 from aiz.cpu import GetCPUDevice
-from sparklines import sparklines
+from aiz.history import DEFAULT_HISTORY
+from aiz.devicecache import loadDeviceCache, saveDeviceCache
+import aiz.instrument as instrument
+from aiz.sparkline import renderSparkline
+from aiz.throttle import throttleLabel
+from aiz.screen import Lines, drawTiles
+from aiz.bottleneck import CLASSES
+from aiz.interconnect import linkMatrix
+from aiz.container import visibleDevices, inContainer
 
 
 gpuDevices = []
 cpuDevice = None
 
-def DetectHardware():
+def listNvidiaDevices(history, dcgm, visible):
+    """ Return the NVIDIA GPUs, with the DCGM profiling fields when a host engine answers """
+    gpus = ListDCGMGPUDevices(history, visible) if dcgm else None
+    return gpus if gpus is not None else ListNVIDIAGPUDevices(history, visible=visible)
+
+def DetectHardware(history=DEFAULT_HISTORY, dcgm=True, container=True):
+    """ Find the GPUs and the CPU
+
+    Parameters:
+    history -- Number of samples kept for each metric
+    dcgm -- Use the DCGM backend for NVIDIA GPUs when available
+    container -- Only list the GPUs the container or the *_VISIBLE_DEVICES variables allow,
+                 and account the CPU and memory to the cgroup when it is limited
+    """
     print('Detecting Hardware...')
     global gpuDevices
     global cpuDevice
-    #GPU devices
-    gpuDevices = ListAMDGPUDevices(False)
-    gpuDevices.extend(ListNVIDIAGPUDevices())
-    cpuDevice = GetCPUDevice()
+    identities = loadDeviceCache()
+    cached = dict(identities)
+    visibleNvidia = visibleDevices(['CUDA_VISIBLE_DEVICES']) if container else None
+    visibleAmd = visibleDevices(['ROCR_VISIBLE_DEVICES', 'HIP_VISIBLE_DEVICES']) if container else None
+    renderNodes = container and inContainer()
+    # The backends don't depend on each other, NVML init no longer waits for the sysfs scan
+    with ThreadPoolExecutor(max_workers=3) as executor:
+        amd = executor.submit(ListAMDGPUDevices, False, history, identities, visibleAmd, renderNodes)
+        nvidia = executor.submit(listNvidiaDevices, history, dcgm, visibleNvidia)
+        cpu = executor.submit(GetCPUDevice, history, container)
+        #GPU devices
+        gpuDevices = amd.result() + nvidia.result()
+        cpuDevice = cpu.result()
+    if identities != cached:
+        saveDeviceCache(identities)
+
+def SetDevices(gpus, cpu):
+    """ Display the given devices instead of the detected ones """
+    global gpuDevices
+    global cpuDevice
+    gpuDevices = gpus
+    cpuDevice = cpu
 
+def GetDevices():
+    """ Return every detected device, GPUs first and the CPU last """
+    return gpuDevices + [cpuDevice]
 
 
 # TODO Add more info
@@ -40,82 +85,386 @@ def PrintHardwareInfo():
     print('Mem:%5f MB' % cpuDevice.memory)
 
 
-def DrawGraph(title, y_data):
-    win.addch('\n')
+def DrawGraph(win, curses, title, label, history, width):
+    """ Draw a two row graph of a 0-100 % history, the title beside the top row and the label beside the bottom one
+
+    Parameters:
+    title -- Text before the top row
+    label -- Format of the newest sample, before the bottom row
+    history -- RingBuffer or any object with Last(n) and Latest()
+    width -- Number of samples drawn
+    """
+    line = renderSparkline(history, width)
     win.addstr(title)
-    y=gpuDevices[i].gpu_usage
-    line = sparklines(y,num_lines=2, minimum=0, maximum=100)
-    win.addstr(line[0])
+    win.addstr(line[0], curses.color_pair(1))
     win.addch('\n')
-    win.addstr('%3d %%  ' % gpuDevices[i].gpu_usage[index])
-    win.addstr(line[1])
-
-def DisplayStats(win, curses):
+    win.addstr(label % history.Latest())
+    win.addstr(line[1], curses.color_pair(1))
 
+def GraphWidth(win):
+    """ Return the number of samples that fit in a graph next to its 8 column label """
+    return max(1, win.getmaxyx()[1] - 9)
 
+def DrawEvents(win, curses, gpu, width):
+    """ Draw the events of a GPU under its usage graph, each marker at the sample it arrived in """
+    count = gpu.gpu_usage.count
+    # Columns of the graph, the newest sample is in the last one even before the history is full
+    columns = min(width, len(gpu.gpu_usage))
+    markers = [' '] * columns
+    last = None
+    for sample, marker, detail in list(gpu.events):
+        position = columns - (count - sample)
+        if 0 <= position < columns:
+            # Xid errors hide anything else in the same column
+            if markers[position] != 'X':
+                markers[position] = marker
+            last = detail
+    win.addch('\n')
+    win.addstr('EVENTS ')
+    win.addstr(''.join(markers), curses.color_pair(1))
+    # Always two lines, the grid layout needs tiles of a stable height
+    win.addch('\n')
+    win.addstr('       %s' % (last or ''))
 
-    # Draw GPU Info
-    for i in range(0, len(gpuDevices)):
-        index = gpuDevices[i].MAX_SAMPLES-1
-        gpuDevices[i].Sample()
+def DrawGpu(win, curses, gpu, width):
+    """ Draw the header and graphs of one GPU, without a newline after the last graph
 
-        
-        win.addstr('%s  TEMP:%3.0f C FAN: %2.0f %%' % (gpuDevices[i].name, gpuDevices[i].temp, gpuDevices[i].fan))
-        
-        
-        #gpu usage
+    Parameters:
+    gpu -- GPU device
+    width -- Number of samples of each graph
+    """
+    win.addstr('%s  TEMP:%3.0f C FAN: %2.0f %%  PCIE:%5.0f MB/s' % (gpu.name, gpu.temp, gpu.fan, gpu.pcie_bw.Latest()))
+    throttle = throttleLabel(getattr(gpu, 'throttle', 0))
+    if throttle:
+        win.addstr('  THROTTLE:%s' % throttle, curses.A_BOLD)
+    if hasattr(gpu, 'gpu_clock_mhz'):
         win.addch('\n')
-        win.addstr('USAGE  ')
-        y=gpuDevices[i].gpu_usage
-        line = sparklines(y,num_lines=2, minimum=0, maximum=100)
-        win.addstr(line[0], curses.color_pair(1))
+        win.addstr('SCLK:%5.0f MHz  MCLK:%5.0f MHz  POWER:%4.0f/%4.0f W' % (gpu.gpu_clock_mhz, gpu.mem_clock_mhz,
+                   gpu.power_watts, gpu.power_cap))
+
+    if hasattr(gpu, 'nvlink_tx'):
         win.addch('\n')
-        win.addstr('%3d %%  ' % gpuDevices[i].gpu_usage[index])
-        win.addstr(line[1], curses.color_pair(1))
+        win.addstr('NVLINK TX:%6.0f MB/s  RX:%6.0f MB/s' % (gpu.nvlink_tx, gpu.nvlink_rx))
+
+    #gpu usage
+    win.addch('\n')
+    DrawGraph(win, curses, 'USAGE  ', '%3d %%  ', gpu.gpu_usage, width)
+    if hasattr(gpu, 'events'):
+        DrawEvents(win, curses, gpu, width)
 
-        #vram usage
-        #vram_size = 8 * 1024 * 1024 * 1024
+    #DCGM profiling activities, only on the DCGM backend
+    if hasattr(gpu, 'sm_active'):
         win.addch('\n')
         win.addch('\n')
-        win.addstr('VRAM   ')
-        y=gpuDevices[i].vram_usage
-        line = sparklines(y,num_lines=2, minimum=0, maximum=100)
-        win.addstr(line[0], curses.color_pair(1))
+        DrawGraph(win, curses, 'SM ACT ', '%3d %%  ', gpu.sm_active, width)
         win.addch('\n')
-        win.addstr('%3d %%  ' % gpuDevices[i].vram_usage[index])
-        win.addstr(line[1], curses.color_pair(1))
- 
-        
-        #pcie bandwidth
         win.addch('\n')
+        DrawGraph(win, curses, 'SM OCC ', '%3d %%  ', gpu.sm_occupancy, width)
         win.addch('\n')
-        win.addstr('PCIE    ')
-        y=gpuDevices[i].pcie_bw
-        line = sparklines(y,num_lines=2, minimum=0, maximum=100)
-        win.addstr(line[0], curses.color_pair(1))
         win.addch('\n')
-        win.addstr('%3d MB/s' % gpuDevices[i].pcie_bw[index])
-        win.addstr(line[1], curses.color_pair(1))
+        DrawGraph(win, curses, 'TENSOR ', '%3d %%  ', gpu.tensor_active, width)
+        win.addch('\n')
+        win.addch('\n')
+        DrawGraph(win, curses, 'DRAM   ', '%3d %%  ', gpu.dram_active, width)
+
+    #vram usage
+    win.addch('\n')
+    win.addch('\n')
+    DrawGraph(win, curses, 'VRAM   ', '%3d %%  ', gpu.vram_usage, width)
 
+    #memory controller busy, missing from older recordings
+    if hasattr(gpu, 'mem_busy'):
         win.addch('\n')
-        
-    #Draw CPU stats
+        win.addch('\n')
+        DrawGraph(win, curses, 'MEM BW ', '%3d %%  ', gpu.mem_busy, width)
+
+    #pcie bandwidth, in % of the link bandwidth
+    win.addch('\n')
+    win.addch('\n')
+    DrawGraph(win, curses, 'PCIE TX ', '%3d %%   ', gpu.pcie_tx, width)
+
     win.addch('\n')
     win.addch('\n')
+    DrawGraph(win, curses, 'PCIE RX ', '%3d %%   ', gpu.pcie_rx, width)
+
+def DrawGpuLine(win, curses, index, gpu, cols):
+    """ Draw one GPU on a single line, its usage as a one row sparkline
+
+    Parameters:
+    index -- Position of the GPU
+    gpu -- GPU device
+    cols -- Width of the line
+    """
+    text = '%2d %-16.16s USE %3d %% MEM %3d %% VRAM %3d %% %3.0f C ' % (index, gpu.name, gpu.gpu_usage.Latest(),
+           gpu.mem_busy.Latest() if hasattr(gpu, 'mem_busy') else 0, gpu.vram_usage.Latest(), gpu.temp)
+    win.addstr(text)
+    throttle = throttleLabel(getattr(gpu, 'throttle', 0))
+    win.addstr('%-5.5s ' % throttle, curses.A_BOLD)
+    width = cols - len(text) - 7
+    if width > 0:
+        win.addstr(renderSparkline(gpu.gpu_usage, width, lines=1)[0].rjust(width), curses.color_pair(1))
+
+def DrawCpu(win, curses, width):
     win.addstr('%s' % cpuDevice.name)
+    #cgroup quota, throttling and pressure, only when accounted to a cgroup
+    if hasattr(cpuDevice, 'cpu_throttled'):
+        if hasattr(cpuDevice, 'cgroup_cpus'):
+            win.addstr('  CGROUP %.1f CPUS' % cpuDevice.cgroup_cpus)
+        win.addstr('  THROTTLED %3d %%  PSI CPU %4.1f %%  MEM %4.1f %%' % (cpuDevice.cpu_throttled.Latest(),
+                   cpuDevice.cpu_pressure.Latest(), cpuDevice.mem_pressure.Latest()),
+                   curses.A_BOLD if cpuDevice.cpu_throttled.Latest() >= 1 else 0)
     win.addch('\n')
-    cpuDevice.Sample()
 
-    index = cpuDevice.MAX_SAMPLES-1
-        
     #cpu usage
-    win.addstr('USAGE  ')
-    y=cpuDevice.cpu_usage
-    line = sparklines(y,num_lines=2, minimum=0, maximum=100)
-    win.addstr(line[0], curses.color_pair(1))
+    DrawGraph(win, curses, 'USAGE  ', '%3d %%  ', cpuDevice.cpu_usage, width)
+
+    #host memory and swap, missing from older recordings
+    if hasattr(cpuDevice, 'swap_usage'):
+        win.addch('\n')
+        win.addch('\n')
+        DrawGraph(win, curses, 'RAM    ', '%3d %%  ', cpuDevice.mem_usage, width)
+        win.addch('\n')
+        win.addch('\n')
+        DrawGraph(win, curses, 'SWAP   ', '%3d %%  ', cpuDevice.swap_usage, width)
+
+# Narrowest GPU tile of the grid layout
+MIN_TILE_WIDTH = 64
+# Lines kept under the GPUs for the CPU graphs and the menu
+CPU_LINES = 13
+# Lines of the last drawn GPU tile, the height the next layout is planned with, 0 until measured
+tileHeight = 0
+
+def DisplayStats(win, curses):
+    """ Draw every GPU then the CPU
+
+    GPUs are tiled in the fewest columns that fit them above the CPU, so a
+    single GPU keeps the full width. When even the narrowest tiles don't
+    fit, each GPU gets one line, and only the lines that fit are drawn.
+    Lines the window reserves for what follows, the shown panels, are
+    left free too.
+    """
+    global tileHeight
+    height, cols = win.getmaxyx()
+    gpuLines = max(1, height - CPU_LINES - getattr(win, 'reserved', 0))
+    count = len(gpuDevices)
+    if count and not tileHeight:
+        # Nothing laid out yet, measure one tile
+        tile = Lines()
+        DrawGpu(tile, curses, gpuDevices[0], max(1, cols - 9))
+        tileHeight = len(tile.lines)
+
+    columns = None
+    for n in range(1, max(1, cols // MIN_TILE_WIDTH) + 1):
+        if ((count + n - 1) // n) * (tileHeight + 1) <= gpuLines:
+            columns = n
+            break
+
+    if count and columns:
+        tileWidth = cols // columns
+        tiles = []
+        for gpu in gpuDevices:
+            tile = Lines()
+            DrawGpu(tile, curses, gpu, max(1, tileWidth - 9))
+            tiles.append(tile)
+        tileHeight = max(len(tile.lines) for tile in tiles)
+        for start in range(0, count, columns):
+            drawTiles(win, tiles[start:start + columns], tileWidth)
+            win.addch('\n')
+            win.addch('\n')
+    elif count:
+        shown = count if count <= gpuLines else gpuLines - 1
+        for i in range(0, shown):
+            DrawGpuLine(win, curses, i, gpuDevices[i], cols)
+            win.addch('\n')
+        if shown < count:
+            win.addstr('%d more GPUs, enlarge the terminal to see them' % (count - shown))
+            win.addch('\n')
+        win.addch('\n')
+
+    #Draw CPU stats
+    DrawCpu(win, curses, GraphWidth(win))
+
+
+# Rows of the process panel
+MAX_PROCESS_ROWS = 10
+
+def DisplayProcesses(win, curses, processes):
+    """ Draw the processes using the GPUs, busiest first
+
+    Parameters:
+    processes -- List of (pid, name, gpu index, gpu usage %, vram bytes) from ProcessMonitor
+    """
     win.addch('\n')
-    win.addstr('%3d %%  ' % cpuDevice.cpu_usage[index])
-    win.addstr(line[1], curses.color_pair(1))
-    
+    win.addch('\n')
+    win.addstr('%7s  %-16s %3s  %5s  %8s' % ('PID', 'NAME', 'GPU', 'USE', 'VRAM'))
+    ordered = sorted(processes, key=lambda process: (process[3], process[4]), reverse=True)
+    for pid, name, gpu, usage, vram in ordered[:MAX_PROCESS_ROWS]:
+        win.addch('\n')
+        win.addstr('%7d  %-16.16s %3d  %3.0f %%  %5.0f MB' % (pid, name, gpu, usage, vram / (1024.0 * 1024.0)), curses.color_pair(1))
+    if not processes:
+        win.addch('\n')
+        win.addstr('No GPU processes')
+
+# Cells of the core heatmap, from idle to fully busy
+HEATMAP_LEVELS = u'·▁▂▃▄▅▆▇█'
+# Samples averaged in each heatmap cell
+HEATMAP_SAMPLES = 10
+
+def DisplayCores(win, curses):
+    """ Draw the usage of every logical cpu as one cell, a row per NUMA node with L3 groups apart """
+    usage = cpuDevice.core_usage.Last(HEATMAP_SAMPLES).mean(axis=0)
+    levels = np.clip((usage * (len(HEATMAP_LEVELS) - 1) / 100.0 + 0.5).astype(int), 0, len(HEATMAP_LEVELS) - 1)
+    width = max(16, win.getmaxyx()[1] - 8)
+
+    win.addch('\n')
+    win.addch('\n')
+    win.addstr('CORES  %d cores, %d threads' % (cpuDevice.num_cores, cpuDevice.num_threads))
+    for node, groups in cpuDevice.cpu_groups:
+        cells = ' '.join(''.join(HEATMAP_LEVELS[levels[cpu]] for cpu in group) for group in groups)
+        for start in range(0, len(cells), width):
+            win.addch('\n')
+            win.addstr('NODE%-3d' % node if start == 0 else '       ')
+            win.addstr(cells[start:start + width], curses.color_pair(1))
+
+# Metrics listed by the instrumentation panel, slowest first
+MAX_LATENCY_ROWS = 12
+
+def DisplayInstrumentation(win, curses, usage):
+    """ Draw the CPU, memory and frame time of ai-z itself, and the latency of each metric read
+
+    Parameters:
+    usage -- SelfUsage of the process
+    """
+    # Metric reads are only timed from the first time the panel is shown
+    instrument.enabled = True
+    cpu, rss = usage.Read()
+    p50, p99, worst = instrument.percentiles(instrument.frameTimes)
+    win.addch('\n')
+    win.addch('\n')
+    win.addstr('AI-Z  CPU %5.1f %%  RSS %6.1f MB  FRAME p50 %5.2f ms  p99 %5.2f ms' % (cpu, rss / (1024.0 * 1024.0), p50 * 1e3, p99 * 1e3))
+    win.addch('\n')
+    win.addstr('%-8s %-16s %10s %10s %10s' % ('BACKEND', 'METRIC', 'P50 US', 'P99 US', 'MAX US'))
+    stats = instrument.latencyStats()
+    for backend, metric, p50, p99, worst in stats[:MAX_LATENCY_ROWS]:
+        win.addch('\n')
+        win.addstr('%-8s %-16.16s %10.1f %10.1f %10.1f' % (backend, metric, p50 * 1e6, p99 * 1e6, worst * 1e6), curses.color_pair(1))
+    if not stats:
+        win.addch('\n')
+        win.addstr('Timing the sampler...')
+
+MAX_STALL_ROWS = 8
+
+def DisplayBottleneck(win, curses, analyzer):
+    """ Draw the share of time spent in each bottleneck class, and the latest stall periods
+
+    Parameters:
+    analyzer -- BottleneckAnalyzer fed by the sampler
+    """
+    run = analyzer.Fractions()
+    recent = analyzer.Fractions(recent=True)
+    win.addch('\n')
+    win.addch('\n')
+    win.addstr('%-16s %8s %8s' % ('BOTTLENECK', 'RUN', 'LAST MIN'))
+    for name in CLASSES:
+        win.addch('\n')
+        win.addstr('%-16s %7.1f%% %7.1f%%' % (name, run[name] * 100.0, recent[name] * 100.0), curses.color_pair(1))
+    stalls = analyzer.Stalls()
+    win.addch('\n')
+    win.addstr('%-16s %8s %10s' % ('STALL', 'AT', 'SECONDS'))
+    for name, start, end in stalls[:MAX_STALL_ROWS]:
+        win.addch('\n')
+        win.addstr('%-16s %8s %10.1f' % (name, time.strftime('%H:%M:%S', time.localtime(start)), end - start), curses.color_pair(1))
+    if not stalls:
+        win.addch('\n')
+        win.addstr('No stall yet')
+
+# Width of one cell of the interconnect matrix, in GB/s
+LINK_CELL_WIDTH = 7
+
+def DisplayInterconnect(win, curses):
+    """ Draw the GPU to GPU matrix of the NVLink throughput, with XGMI and PCIe next to it
+
+    A row splits the link traffic of one GPU, tx + rx in GB/s, by the GPU
+    or switch its links go to, '-' where there is no link. GPUs without a
+    link between them go through the host, which only the PCIE column
+    shows. gpu_metrics doesn't tell which GPU an XGMI link reaches, so
+    AMD links are only summed in the XGMI column. The sparklines share one
+    scale, so busier links stand out.
+    """
+    columns, rows, unattributed = linkMatrix(gpuDevices)
+    # GPUs with links of unknown peer, they get an XGMI cell
+    unknownPeers = [None in (getattr(gpu, 'links', None) or []) for gpu in gpuDevices]
+    xgmi = any(unknownPeers)
+    cell = LINK_CELL_WIDTH
+    width = max(8, win.getmaxyx()[1] - 10 - cell * (len(columns) + 2 + xgmi))
+    histories = [getattr(gpu, 'interconnect_bw', None) for gpu in gpuDevices]
+    peak = max([1.0] + [float(history.Last(width).max()) for history in histories if history is not None])
+
+    win.addch('\n')
+    win.addch('\n')
+    win.addstr('%-8s' % 'LINKS')
+    for column in columns:
+        win.addstr(('GPU%d' % column if isinstance(column, int) else column).rjust(cell))
+    if xgmi:
+        win.addstr('XGMI'.rjust(cell))
+    win.addstr('PCIE'.rjust(cell) + 'TOTAL'.rjust(cell) + '  PEAK %.1f GB/s' % (peak / 1024.0))
+    for i in range(0, len(gpuDevices)):
+        win.addch('\n')
+        win.addstr('GPU%-5d' % i)
+        for column in columns:
+            if column == i:
+                win.addstr('.'.rjust(cell))
+            elif column in rows[i]:
+                win.addstr('%*.1f' % (cell, rows[i][column] / 1024.0), curses.color_pair(1))
+            else:
+                win.addstr('-'.rjust(cell))
+        if xgmi:
+            win.addstr('%*.1f' % (cell, unattributed[i] / 1024.0) if unknownPeers[i] else '-'.rjust(cell), curses.color_pair(1))
+        pcie = gpuDevices[i].pcie_bw.Latest()
+        win.addstr('%*.1f%*.1f' % (cell, pcie / 1024.0, cell, (sum(rows[i].values()) + unattributed[i] + pcie) / 1024.0))
+        if histories[i] is not None:
+            win.addstr('  ' + renderSparkline(histories[i], width, lines=1, maximum=peak)[0], curses.color_pair(1))
+    if not any(rows) and not xgmi:
+        win.addch('\n')
+        win.addstr('No NVLink or XGMI link, GPUs talk through PCIe')
+
+def DisplayCluster(win, curses, view):
+    """ Draw one line per node and one per GPU of every agent of a ClusterView
+
+    Only the lines that fit the window, from the view scroll offset, are
+    formatted, so the cost follows the terminal size and not the GPU count.
+    """
+    height, cols = win.getmaxyx()
+    # (node, gpu index, gpu) of every line, gpu None for the node line
+    rows = []
+    for node in view.nodes:
+        rows.append((node, None, None))
+        gpus = node.GpuDevices()
+        rows.extend((node, i, gpus[i]) for i in range(0, len(gpus)))
+    # Leave room for the menu
+    visible = max(1, height - 3)
+    view.scroll = min(view.scroll, max(0, len(rows) - visible))
+    width = max(1, cols - 48)
 
-    
+    first = True
+    for node, index, gpu in rows[view.scroll:view.scroll + visible]:
+        if not first:
+            win.addch('\n')
+        first = False
+        if index is None:
+            cpu = node.CpuDevice()
+            if not node.connected:
+                win.addstr('%-20.20s  unreachable' % node.host)
+            elif cpu is not None and hasattr(cpu, 'cpu_usage'):
+                win.addstr('%-20.20s  CPU %3d %%                ' % (node.host, cpu.cpu_usage.Latest()))
+                win.addstr(renderSparkline(cpu.cpu_usage, width, lines=1)[0].rjust(width), curses.color_pair(1))
+            else:
+                win.addstr('%-20.20s' % node.host)
+            continue
+        usage = getattr(gpu, 'gpu_usage', None)
+        vram = getattr(gpu, 'vram_usage', None)
+        temp = getattr(gpu, 'temp', None)
+        win.addstr('  %2d %-15.15s USE %3d %% VRAM %3d %% %3dC ' % (index, gpu.name,
+                   usage.Latest() if usage else 0, vram.Latest() if vram else 0, temp.Latest() if temp else 0))
+        if usage:
+            win.addstr(renderSparkline(usage, width, lines=1)[0].rjust(width), curses.color_pair(1))
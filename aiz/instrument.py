@@ -0,0 +1,95 @@
+import os
+import time
+import threading
+import numpy as np
+import psutil
+from aiz.history import RingBuffer
+
+
+# Durations kept for the percentiles of each metric
+LATENCY_SAMPLES = 1024
+# Minimum time between two reads of the process CPU and memory usage
+USAGE_INTERVAL = 1.0
+
+# Sample latencies are only timed once the panel has been shown, so they cost nothing otherwise
+enabled = False
+# (backend, metric) -> RingBuffer of read durations in seconds, shared by the devices of a backend
+latencies = {}
+# The sampler, its pool workers and the slow readers time reads at once, RingBuffer isn't thread safe
+latencyLock = threading.Lock()
+# Time spent drawing each frame, in seconds
+frameTimes = RingBuffer(LATENCY_SAMPLES)
+
+
+def recordLatency(backend, metric, seconds):
+    with latencyLock:
+        history = latencies.get((backend, metric))
+        if history is None:
+            history = latencies[(backend, metric)] = RingBuffer(LATENCY_SAMPLES)
+        history.Append(seconds)
+
+def recordFrame(seconds):
+    frameTimes.Append(seconds)
+
+def percentiles(history):
+    """ Return the (p50, p99, max) of the durations in a history, in seconds """
+    return valuePercentiles(history.Last(min(history.count, len(history))))
+
+def valuePercentiles(values):
+    if len(values) == 0:
+        return (0.0, 0.0, 0.0)
+    p50, p99 = np.percentile(values, [50, 99])
+    return (p50, p99, values.max())
+
+def latencyStats():
+    """ Return [(backend, metric, p50, p99, max)] of every timed metric, slowest p99 first """
+    with latencyLock:
+        # Copies, so the percentiles are computed outside the lock
+        samples = [(key, history.Last(min(history.count, len(history))).copy()) for key, history in latencies.items()]
+    stats = [key + valuePercentiles(values) for key, values in samples]
+    stats.sort(key=lambda stat: stat[3], reverse=True)
+    return stats
+
+
+class SampleTimer:
+    """ Times the consecutive metric reads of a Sample() call
+
+    Mark(metric) records the time since Start() or the previous mark, so a
+    Sample() method only needs a mark after each of its reads.
+
+    Parameters:
+    backend -- Name the metrics are grouped under, like 'amd'
+    """
+    def __init__(self, backend):
+        self.backend = backend
+        self.last = None
+
+    def Start(self):
+        self.last = time.perf_counter() if enabled else None
+
+    def Mark(self, metric):
+        if self.last is None:
+            return
+        now = time.perf_counter()
+        recordLatency(self.backend, metric, now - self.last)
+        self.last = now
+
+
+class SelfUsage:
+    """ CPU usage and resident memory of the ai-z process, refreshed at most every USAGE_INTERVAL """
+    def __init__(self):
+        self.process = psutil.Process(os.getpid())
+        self.lastRead = 0.0
+        self.cpu = 0.0
+        self.rss = 0
+        # Starts the CPU time measurement
+        self.process.cpu_percent()
+
+    def Read(self):
+        """ Return (cpu %, rss bytes) """
+        now = time.monotonic()
+        if now - self.lastRead >= USAGE_INTERVAL:
+            self.lastRead = now
+            self.cpu = self.process.cpu_percent()
+            self.rss = self.process.memory_info().rss
+        return (self.cpu, self.rss)
@@ -0,0 +1,81 @@
+#=============================================
+# GPU to GPU interconnect: per-link throughput from the cumulative NVLink
+# and XGMI counters, and the matrix of which GPU each link goes to.
+#=============================================
+
+import numpy as np
+
+
+# Peer column of links that end on an NVSwitch, a CPU or a device that isn't a listed GPU
+PEER_SWITCH = 'SW'
+
+
+class LinkCounters:
+    """ Throughput of each link of a GPU from cumulative byte counters
+
+    Parameters:
+    links -- Number of links
+    scale -- Bytes per counter unit, like 1024 for KiB counters
+    """
+    def __init__(self, links, scale):
+        self.scale = scale
+        self.previous = None
+        self.timestamp = None
+        self.rates = np.zeros(links)
+
+    def Update(self, counters, timestamp):
+        """ Return the MB/s of every link since the previous update, None until two updates are apart
+
+        Parameters:
+        counters -- Cumulative counter of every link, None for a link that couldn't be read
+        timestamp -- Time the counters were taken, in seconds
+        """
+        previous, last = self.previous, self.timestamp
+        self.previous = counters
+        self.timestamp = timestamp
+        if previous is None or timestamp <= last:
+            return None
+        seconds = timestamp - last
+        for i in range(0, len(counters)):
+            if counters[i] is None or previous[i] is None or counters[i] < previous[i]:
+                # Unreadable, or the counter wrapped, the link keeps its last rate
+                continue
+            self.rates[i] = (counters[i] - previous[i]) * self.scale / seconds / (1024.0 * 1024.0)
+        return self.rates
+
+
+def linkMatrix(gpus):
+    """ Return (columns, rows, unattributed) of the GPU to GPU throughput matrix
+
+    columns are GPU indices, then PEER_SWITCH when some link ends there.
+    rows has one {column: MB/s} per GPU, only holding the columns a link
+    of the GPU goes to, so a missing cell means no link. Links whose peer
+    isn't known, like the XGMI links of gpu_metrics, stay out of the
+    matrix and are summed per GPU in unattributed, in MB/s.
+
+    Parameters:
+    gpus -- GPU devices, those with links have links (peer bus ids or None) and link_bw
+    """
+    busIds = dict((getattr(gpus[i], 'bus_id', None), i) for i in range(0, len(gpus)))
+    columns = list(range(0, len(gpus)))
+    switched = False
+    rows = []
+    unattributed = []
+    for gpu in gpus:
+        row = {}
+        unknown = 0.0
+        links = getattr(gpu, 'links', None) or []
+        if links:
+            rates = gpu.link_bw.Latest()
+            for i in range(0, len(links)):
+                if links[i] is None:
+                    unknown += float(rates[i])
+                    continue
+                peer = busIds.get(links[i], PEER_SWITCH)
+                switched = switched or peer == PEER_SWITCH
+                row[peer] = row.get(peer, 0.0) + float(rates[i])
+        rows.append(row)
+        unattributed.append(unknown)
+    if switched:
+        columns.append(PEER_SWITCH)
+    return (columns, rows, unattributed)
@@ -0,0 +1,165 @@
+#=============================================
+# Bindings for the NVML functions py3nvml doesn't provide:
+# nvmlDeviceGetFieldValues and nvmlDeviceGetProcessUtilization.
+# Structures and constants follow nvml.h
+#=============================================
+
+from ctypes import Structure, Union, c_uint, c_int, c_double, c_ulong, c_ulonglong, c_longlong, byref
+from py3nvml.py3nvml import NVMLError, NVML_SUCCESS, NVML_ERROR_INSUFFICIENT_SIZE, NVML_ERROR_NOT_FOUND, _nvmlGetFunctionPointer
+
+
+NVML_VALUE_TYPE_DOUBLE = 0
+NVML_VALUE_TYPE_UNSIGNED_INT = 1
+NVML_VALUE_TYPE_UNSIGNED_LONG = 2
+NVML_VALUE_TYPE_UNSIGNED_LONG_LONG = 3
+NVML_VALUE_TYPE_SIGNED_LONG_LONG = 4
+NVML_VALUE_TYPE_SIGNED_INT = 5
+
+# Cumulative PCIe byte counters, the value can wrap
+NVML_FI_DEV_PCIE_COUNT_TX_BYTES = 197
+NVML_FI_DEV_PCIE_COUNT_RX_BYTES = 198
+# Instant power draw in milliwatts, scope 0 is the whole GPU
+NVML_FI_DEV_POWER_INSTANT = 186
+# Cumulative NVLink data counters in KiB, scoped by link, without protocol overhead
+NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_TX = 138
+NVML_FI_DEV_NVLINK_THROUGHPUT_DATA_RX = 139
+NVML_NVLINK_MAX_LINKS = 18
+
+
+class c_nvmlValue_t(Union):
+    _fields_ = [
+        ('dVal', c_double),
+        ('uiVal', c_uint),
+        ('ulVal', c_ulong),
+        ('ullVal', c_ulonglong),
+        ('sllVal', c_longlong),
+        ('siVal', c_int),
+    ]
+
+class c_nvmlFieldValue_t(Structure):
+    _fields_ = [
+        ('fieldId', c_uint),
+        ('scopeId', c_uint),
+        ('timestamp', c_longlong),
+        ('latencyUsec', c_longlong),
+        ('valueType', c_int),
+        ('nvmlReturn', c_int),
+        ('value', c_nvmlValue_t),
+    ]
+
+valueTypeMembers = {
+    NVML_VALUE_TYPE_DOUBLE : 'dVal',
+    NVML_VALUE_TYPE_UNSIGNED_INT : 'uiVal',
+    NVML_VALUE_TYPE_UNSIGNED_LONG : 'ulVal',
+    NVML_VALUE_TYPE_UNSIGNED_LONG_LONG : 'ullVal',
+    NVML_VALUE_TYPE_SIGNED_LONG_LONG : 'sllVal',
+    NVML_VALUE_TYPE_SIGNED_INT : 'siVal',
+}
+
+
+def getFieldValuesFunction():
+    """ Return nvmlDeviceGetFieldValues, or None on drivers that predate it """
+    try:
+        return _nvmlGetFunctionPointer('nvmlDeviceGetFieldValues')
+    except NVMLError:
+        return None
+
+
+class NVMLFieldBatch:
+    """ NVML field values of one device, all fetched in one driver call
+
+    Fields the driver doesn't support are dropped at construction, so
+    Supports() tells which metrics need the per-call API instead.
+
+    Parameters:
+    device -- NVML device handle
+    fields -- List of (name, fieldId, scopeId) tuples
+    """
+    def __init__(self, device, fields):
+        self.device = device
+        self.getFieldValues = getFieldValuesFunction()
+        self.select(fields if self.getFieldValues else [])
+        if self.Fetch():
+            self.select([fields[i] for i in range(0, len(fields)) if self.values[i].nvmlReturn == NVML_SUCCESS])
+        else:
+            self.select([])
+
+    def select(self, fields):
+        self.names = [field[0] for field in fields]
+        self.index = dict((self.names[i], i) for i in range(0, len(self.names)))
+        self.values = (c_nvmlFieldValue_t * len(fields))()
+        for i in range(0, len(fields)):
+            self.values[i].fieldId = fields[i][1]
+            self.values[i].scopeId = fields[i][2]
+
+    def Fetch(self):
+        """ Refresh every field, returns False if nothing could be read """
+        if not self.names:
+            return False
+        return self.getFieldValues(self.device, c_int(len(self.names)), self.values) == NVML_SUCCESS
+
+    def Supports(self, name):
+        return name in self.index
+
+    def Value(self, name):
+        """ Return the last fetched value of a field, or None if it couldn't be read """
+        fieldValue = self.values[self.index[name]]
+        if fieldValue.nvmlReturn != NVML_SUCCESS or fieldValue.valueType not in valueTypeMembers:
+            return None
+        return getattr(fieldValue.value, valueTypeMembers[fieldValue.valueType])
+
+    def Timestamp(self, name):
+        """ Return the time the last fetched value was taken, in microseconds """
+        return self.values[self.index[name]].timestamp
+
+
+class c_nvmlProcessUtilizationSample_t(Structure):
+    _fields_ = [
+        ('pid', c_uint),
+        ('timeStamp', c_ulonglong),
+        ('smUtil', c_uint),
+        ('memUtil', c_uint),
+        ('encUtil', c_uint),
+        ('decUtil', c_uint),
+    ]
+
+
+class NVMLProcessUtilization:
+    """ Per-process utilization samples of one device, read with nvmlDeviceGetProcessUtilization
+
+    The sample buffer is kept between calls and only grows when the driver
+    reports more processes than it holds.
+
+    Parameters:
+    device -- NVML device handle
+    """
+    def __init__(self, device):
+        self.device = device
+        try:
+            self.getProcessUtilization = _nvmlGetFunctionPointer('nvmlDeviceGetProcessUtilization')
+        except NVMLError:
+            self.getProcessUtilization = None
+        self.samples = (c_nvmlProcessUtilizationSample_t * 16)()
+        self.lastSeen = 0
+
+    def Read(self):
+        """ Return {pid: sm utilization %} of the samples taken since the previous call """
+        if not self.getProcessUtilization:
+            return {}
+        while True:
+            count = c_uint(len(self.samples))
+            ret = self.getProcessUtilization(self.device, self.samples, byref(count), c_ulonglong(self.lastSeen))
+            if ret != NVML_ERROR_INSUFFICIENT_SIZE:
+                break
+            self.samples = (c_nvmlProcessUtilizationSample_t * max(count.value, 2 * len(self.samples)))()
+        if ret != NVML_SUCCESS:
+            # NVML_ERROR_NOT_FOUND only means no new sample since lastSeen
+            if ret != NVML_ERROR_NOT_FOUND:
+                self.getProcessUtilization = None
+            return {}
+        usage = {}
+        for i in range(0, count.value):
+            sample = self.samples[i]
+            usage[sample.pid] = max(usage.get(sample.pid, 0), sample.smUtil)
+            self.lastSeen = max(self.lastSeen, sample.timeStamp)
+        return usage
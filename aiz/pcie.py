@@ -0,0 +1,71 @@
+# Usable bandwidth of one PCIe lane in each direction, in MB/s, by generation
+PCIE_LANE_BANDWIDTH = {1 : 250.0, 2 : 500.0, 3 : 984.6, 4 : 1969.2, 5 : 3938.5, 6 : 7563.0}
+
+# Transfer rate in GT/s of each generation, as reported by the kernel
+PCIE_GEN_SPEEDS = {2.5 : 1, 5.0 : 2, 8.0 : 3, 16.0 : 4, 32.0 : 5, 64.0 : 6}
+
+# Locations of the PCI id database across distributions
+PCI_IDS_PATHS = ['/usr/share/hwdata/pci.ids', '/usr/share/misc/pci.ids', '/usr/share/pci.ids']
+
+
+def pcieLinkBandwidth(gen, width):
+    """ Return the bandwidth of a PCIe link in each direction, in MB/s, or 0 if unknown
+
+    Parameters:
+    gen -- PCIe generation
+    width -- Number of lanes
+    """
+    try:
+        return PCIE_LANE_BANDWIDTH.get(int(gen), 0.0) * int(width)
+    except (TypeError, ValueError):
+        return 0.0
+
+def pcieGenFromSpeed(speed):
+    """ Return the PCIe generation of a link speed string like '16.0 GT/s PCIe', or 0 if unknown """
+    try:
+        return PCIE_GEN_SPEEDS.get(float(speed.split()[0]), 0)
+    except (AttributeError, IndexError, ValueError):
+        return 0
+
+def pciePercent(mbps, linkBandwidth):
+    """ Return a throughput in MB/s as a percentage of the link bandwidth """
+    if linkBandwidth <= 0:
+        return 0.0
+    return min(100.0, 100.0 * mbps / linkBandwidth)
+
+def normalizeBusId(busId):
+    """ Return a PCI bus id in the sysfs form, like 0000:03:00.0
+
+    NVML reports an 8 digit domain, and may return bytes.
+    """
+    if isinstance(busId, bytes):
+        busId = busId.decode()
+    domain, _, rest = busId.strip().lower().rpartition(':')
+    domain, _, bus = domain.rpartition(':')
+    return '%04x:%s:%s' % (int(domain or '0', 16), bus, rest)
+
+def pciDeviceName(vendor, device):
+    """ Return the name of a PCI device in the PCI id database, or None if it isn't listed
+
+    Parameters:
+    vendor -- Vendor id, like 0x1002
+    device -- Device id
+    """
+    vendorPrefix = '%04x ' % vendor
+    devicePrefix = '\t%04x ' % device
+    for path in PCI_IDS_PATHS:
+        try:
+            with open(path, 'r', encoding='utf-8', errors='replace') as ids:
+                inVendor = False
+                for line in ids:
+                    if inVendor:
+                        if line.startswith(devicePrefix):
+                            return line[len(devicePrefix):].strip()
+                        if not line.startswith('\t') and not line.startswith('#') and line.strip():
+                            return None
+                    elif line.startswith(vendorPrefix):
+                        inVendor = True
+        except OSError:
+            continue
+        return None
+    return None
@@ -0,0 +1,159 @@
+import os
+import time
+from aiz.worker import AsyncReader
+from aiz.pcie import normalizeBusId
+
+
+# Time between two refreshes of the process list
+PROCESS_INTERVAL = 1.0
+# Fds of known processes are scanned again this often when the kernel doesn't report their count
+FDINFO_RESCAN_SECONDS = 10.0
+
+
+def fdCount(pid):
+    """ Return the number of open fds of a process, 0 if the kernel doesn't report it """
+    try:
+        return os.stat('/proc/%d/fd' % pid).st_size
+    except OSError:
+        return 0
+
+def readProcessName(pid):
+    try:
+        with open('/proc/%d/comm' % pid, 'r') as comm:
+            return comm.read().rstrip('\n')
+    except OSError:
+        return '?'
+
+def parseFdinfo(path):
+    """ Return the drm fields of an fdinfo file as a dict, empty for other fds """
+    fields = {}
+    try:
+        with open(path, 'r') as fdinfo:
+            for line in fdinfo:
+                if line.startswith('drm-'):
+                    key, _, value = line.partition(':')
+                    fields[key] = value.strip()
+    except OSError:
+        pass
+    return fields
+
+def parseFdinfoAmount(value):
+    """ Return the number of an fdinfo value like '1234 ns' or '56 KiB', in ns or bytes """
+    parts = value.split()
+    scale = {'KiB' : 1024, 'MiB' : 1024 * 1024, 'GiB' : 1024 * 1024 * 1024}
+    try:
+        return int(parts[0]) * (scale.get(parts[1], 1) if len(parts) > 1 else 1)
+    except (IndexError, ValueError):
+        return 0
+
+
+class AMDFdinfoScanner:
+    """ amdgpu clients of every process, read from /proc/<pid>/fdinfo
+
+    Only new processes get their fds scanned. A known process is scanned
+    again when its fd count changes, or every FDINFO_RESCAN_SECONDS on
+    kernels that don't report it. A refresh therefore costs a listdir of
+    /proc, a stat per process and a read per DRM fd.
+    """
+    def __init__(self):
+        # pid -> [fd count, time of the next forced rescan, fdinfo paths of its DRM fds]
+        self.processes = {}
+        # (pci device, client id) -> (busy engine ns, time) of the previous refresh
+        self.engines = {}
+
+    def scanFds(self, pid):
+        paths = []
+        fdDir = '/proc/%d/fd' % pid
+        for fd in os.listdir(fdDir):
+            try:
+                if os.readlink(os.path.join(fdDir, fd)).startswith('/dev/dri/'):
+                    paths.append('/proc/%d/fdinfo/%s' % (pid, fd))
+            except OSError:
+                pass
+        return paths
+
+    def Read(self):
+        """ Return {bus id: [(pid, gpu usage %, vram bytes)]} of the amdgpu clients """
+        now = time.monotonic()
+        pids = set(int(pid) for pid in os.listdir('/proc') if pid.isdigit())
+        for pid in list(self.processes.keys()):
+            if pid not in pids:
+                del self.processes[pid]
+
+        for pid in pids:
+            entry = self.processes.get(pid)
+            count = fdCount(pid)
+            if entry is None or (count and count != entry[0]) or (not count and now >= entry[1]):
+                try:
+                    paths = self.scanFds(pid)
+                except OSError:
+                    # Exited, or not ours to look at
+                    paths = []
+                self.processes[pid] = [count, now + FDINFO_RESCAN_SECONDS, paths]
+
+        clients = {}
+        engines = {}
+        for pid, entry in self.processes.items():
+            for path in entry[2]:
+                fields = parseFdinfo(path)
+                if fields.get('drm-driver') != 'amdgpu':
+                    continue
+                key = (fields.get('drm-pdev', ''), fields.get('drm-client-id', path))
+                # Several fds can share a client
+                if key in engines:
+                    continue
+                busy = max(parseFdinfoAmount(fields.get('drm-engine-gfx', '0')), parseFdinfoAmount(fields.get('drm-engine-compute', '0')))
+                vram = parseFdinfoAmount(fields.get('drm-memory-vram', fields.get('drm-resident-vram', '0')))
+                engines[key] = (busy, now)
+                usage = 0.0
+                previous = self.engines.get(key)
+                if previous and now > previous[1]:
+                    usage = min(100.0, 100.0 * (busy - previous[0]) / ((now - previous[1]) * 1e9))
+                busId = normalizeBusId(key[0]) if key[0] else ''
+                clients.setdefault(busId, []).append((pid, max(0.0, usage), vram))
+        self.engines = engines
+        return clients
+
+
+class ProcessMonitor:
+    """ Processes using each GPU, refreshed on a worker thread once first displayed
+
+    GPUs with a Processes() method report their own processes, the others
+    are looked up by bus id among the amdgpu fdinfo clients.
+
+    Parameters:
+    gpus -- GPU devices found by DetectHardware()
+    """
+    def __init__(self, gpus):
+        self.gpus = gpus
+        self.scanner = None
+        if any(not hasattr(gpu, 'Processes') for gpu in gpus):
+            self.scanner = AMDFdinfoScanner()
+        self.names = {}
+        self.reader = None
+
+    def Read(self):
+        """ Return [(pid, name, gpu index, gpu usage %, vram bytes)] """
+        clients = self.scanner.Read() if self.scanner else {}
+        processes = []
+        for i in range(0, len(self.gpus)):
+            gpu = self.gpus[i]
+            if hasattr(gpu, 'Processes'):
+                entries = gpu.Processes()
+            else:
+                entries = clients.get(getattr(gpu, 'bus_id', None), [])
+            for pid, usage, vram in entries:
+                processes.append((pid, None, i, usage, vram))
+
+        names = {}
+        for pid, _, _, _, _ in processes:
+            names[pid] = self.names[pid] if pid in self.names else readProcessName(pid)
+        self.names = names
+        return [(pid, names[pid], gpu, usage, vram) for pid, _, gpu, usage, vram in processes]
+
+    def Processes(self):
+        """ Return the last read process list, starting the worker on first use """
+        if self.reader is None:
+            self.reader = AsyncReader('aiz-processes', self.Read, PROCESS_INTERVAL, [])
+            self.reader.start()
+        return self.reader.value
@@ -0,0 +1,98 @@
+import json
+import struct
+import time
+import numpy as np
+from aiz.history import RingBuffer, metricValue
+
+
+# File layout:
+#   RECORD_MAGIC
+#   uint32 little endian length of the header
+#   JSON header, padded with spaces to a multiple of 8 bytes
+#   Fixed width records: float64 wall clock timestamp, then one float32 per column
+RECORD_MAGIC = b'AIZREC1\n'
+RECORD_VERSION = 1
+
+# Records are written in batches of at most this many, or this many seconds
+FLUSH_RECORDS = 256
+FLUSH_SECONDS = 1.0
+
+
+def recordHeader(devices, interval):
+    """ Return the header describing the devices and columns of a recording
+
+    Parameters:
+    devices -- Devices found by DetectHardware()
+    interval -- Sampling interval in seconds
+    """
+    header = {'version' : RECORD_VERSION, 'interval' : interval, 'start' : time.time(), 'devices' : []}
+    for device in devices:
+        histories = [name for name in device.METRICS if isinstance(getattr(device, name), RingBuffer)]
+        header['devices'].append({'name' : device.name, 'type' : type(device).__name__,
+                                  'metrics' : list(device.METRICS), 'histories' : histories})
+    return header
+
+def recordDtype(header):
+    """ Return the numpy dtype of one record described by a header """
+    columns = sum(len(device['metrics']) for device in header['devices'])
+    return np.dtype([('timestamp', '<f8'), ('values', '<f4', (columns,))])
+
+def encodeHeader(header):
+    """ Return the bytes that start a recording, up to the first record """
+    data = json.dumps(header).encode()
+    data += b' ' * (-(len(RECORD_MAGIC) + 4 + len(data)) % 8)
+    return RECORD_MAGIC + struct.pack('<I', len(data)) + data
+
+def readHeader(f):
+    """ Return (header, offset of the first record) of an open recording """
+    if f.read(len(RECORD_MAGIC)) != RECORD_MAGIC:
+        raise ValueError('Not an ai-z recording')
+    length = struct.unpack('<I', f.read(4))[0]
+    header = json.loads(f.read(length).decode())
+    return (header, len(RECORD_MAGIC) + 4 + length)
+
+
+class Recorder:
+    """ Append the newest value of every device metric to a recording after each sampler pass
+
+    Records are filled in a preallocated buffer and written with a single
+    write per batch, so recording costs a few copies per pass.
+
+    Parameters:
+    path -- Recording file, overwritten
+    devices -- Devices found by DetectHardware()
+    interval -- Sampling interval in seconds
+    """
+    def __init__(self, path, devices, interval):
+        self.header = recordHeader(devices, interval)
+        # Histories are kept directly, plain values are read from their device
+        self.columns = []
+        for device in devices:
+            for name in device.METRICS:
+                self.columns.append((device, name))
+        self.buffer = np.zeros(FLUSH_RECORDS, dtype=recordDtype(self.header))
+        self.count = 0
+        self.lastFlush = time.monotonic()
+        self.file = open(path, 'wb', buffering=0)
+        self.file.write(encodeHeader(self.header))
+
+    def Record(self, timestamp):
+        """ Sampler listener, adds one record """
+        record = self.buffer[self.count]
+        record['timestamp'] = timestamp
+        values = record['values']
+        for i in range(0, len(self.columns)):
+            values[i] = metricValue(self.columns[i][0], self.columns[i][1])
+        self.count += 1
+        if self.count == FLUSH_RECORDS or time.monotonic() - self.lastFlush >= FLUSH_SECONDS:
+            self.Flush()
+
+    def Flush(self):
+        if self.count:
+            self.file.write(self.buffer[:self.count].tobytes())
+            self.count = 0
+        self.lastFlush = time.monotonic()
+
+    def Close(self):
+        self.Flush()
+        self.file.close()
@@ -0,0 +1,202 @@
+import os
+import bisect
+import time
+import curses
+import numpy as np
+from aiz.record import readHeader, recordDtype
+
+
+# Zoomed out graphs average at most this many records per column, picked evenly,
+# so a week long view only touches a few pages of the file per frame
+SAMPLES_PER_COLUMN = 16
+MAX_SPEED = 1024
+
+
+class ReplayHistory:
+    """ One column of a recording, read like a RingBuffer ending at the replay position
+
+    Parameters:
+    replay -- Replay the column belongs to
+    column -- Index of the column in the records
+    """
+    def __init__(self, replay, column):
+        self.replay = replay
+        self.column = column
+
+    def Last(self, n=None):
+        """ Return the n columns before the replay position, each one the mean of zoom records """
+        replay = self.replay
+        values = replay.records['values']
+        if n is None:
+            n = replay.position
+        end = replay.position
+        zoom = replay.zoom
+        out = np.zeros(n, dtype=np.float32)
+        if zoom == 1:
+            rows = values[max(0, end - n):end, self.column]
+            out[n - len(rows):] = rows
+            return out
+        step = max(1, zoom // SAMPLES_PER_COLUMN)
+        rows = (end - n * zoom) + (np.arange(0, n) * zoom)[:, None] + np.arange(0, zoom, step)[None, :]
+        valid = rows >= 0
+        samples = values[np.maximum(rows, 0), self.column]
+        counts = valid.sum(axis=1)
+        sums = np.where(valid, samples, 0).sum(axis=1)
+        np.divide(sums, counts, out=out, where=counts > 0)
+        return out
+
+    def Latest(self):
+        if self.replay.position == 0:
+            return 0.0
+        return self.replay.records['values'][self.replay.position - 1, self.column]
+
+
+class ReplayDevice:
+    """ Stand-in for a live device, with the metrics of a recorded one
+
+    Histories are ReplayHistory objects, plain values are updated by the
+    replay every time its position changes.
+    """
+    def __init__(self, replay, description, firstColumn):
+        self.name = description['name']
+        self.type = description['type']
+        self.METRICS = description['metrics']
+        self.values = {}
+        for i in range(0, len(self.METRICS)):
+            name = self.METRICS[i]
+            if name in description['histories']:
+                setattr(self, name, ReplayHistory(replay, firstColumn + i))
+            else:
+                self.values[name] = firstColumn + i
+                setattr(self, name, 0.0)
+
+    def Sample(self):
+        pass
+
+
+class Replay:
+    """ Memory-mapped recording played back through the live display
+
+    Only the pages around the displayed window are read, so opening a
+    recording is instant whatever its size. Plays at speed times real time,
+    zoom is the number of records averaged in each graph column.
+
+    Parameters:
+    path -- Recording file
+    start -- Start of the replayed range, in seconds from the start of the recording
+    end -- End of the replayed range, in seconds from the start of the recording
+    """
+    def __init__(self, path, start=None, end=None):
+        with open(path, 'rb') as f:
+            self.header, offset = readHeader(f)
+        dtype = recordDtype(self.header)
+        count = (os.path.getsize(path) - offset) // dtype.itemsize
+        if count == 0:
+            raise ValueError('%s has no records' % path)
+        self.records = np.memmap(path, dtype=dtype, mode='r', offset=offset, shape=(count,))
+        self.timestamps = self.records['timestamp']
+
+        self.devices = []
+        column = 0
+        for description in self.header['devices']:
+            self.devices.append(ReplayDevice(self, description, column))
+            column += len(description['metrics'])
+
+        first = self.timestamps[0]
+        self.begin = 0
+        self.end = count
+        # Records are 8 + 4 * columns bytes, the timestamp column is unaligned for odd column
+        # counts and np.searchsorted would copy all of it, bisect only reads log2(count) records
+        if start is not None:
+            self.begin = bisect.bisect_left(self.timestamps, first + start)
+        if end is not None:
+            self.end = max(self.begin + 1, bisect.bisect_right(self.timestamps, first + end))
+
+        self.zoom = 1
+        self.speed = 1
+        self.paused = start is not None or end is not None
+        self.position = self.begin + 1 if not self.paused else self.end
+        # Recording time shown, advanced by the wall clock while playing
+        self.time = self.timestamps[self.position - 1]
+        self.lastUpdate = time.monotonic()
+        # Same interface as Sampler for the main loop
+        self.generation = 0
+        self.error = None
+        self.moved()
+
+    def GpuDevices(self):
+        return [device for device in self.devices if device.type != 'AIZCPU']
+
+    def CpuDevice(self):
+        for device in self.devices:
+            if device.type == 'AIZCPU':
+                return device
+        return None
+
+    def FitRange(self, width):
+        """ Set the zoom so the whole replayed range fits in graphs of width columns """
+        self.zoom = max(1, -(-(self.end - self.begin) // max(1, width)))
+        self.generation += 1
+
+    def Seek(self, position):
+        self.position = min(self.end, max(self.begin + 1, position))
+        self.time = self.timestamps[self.position - 1]
+        self.moved()
+
+    def moved(self):
+        row = self.records['values'][self.position - 1]
+        for device in self.devices:
+            for name, column in device.values.items():
+                setattr(device, name, float(row[column]))
+        self.generation += 1
+
+    def Update(self):
+        """ Advance the position with the wall clock while playing """
+        now = time.monotonic()
+        elapsed = now - self.lastUpdate
+        self.lastUpdate = now
+        if self.paused or self.position >= self.end:
+            return
+        self.time += elapsed * self.speed
+        # Playing only moves forward, from the current position
+        position = bisect.bisect_right(self.timestamps, self.time, self.position, self.end)
+        if position != self.position:
+            self.Seek(position)
+
+    def HandleKey(self, key, width):
+        """ Handle a replay key, returns True if the key was used
+
+        Parameters:
+        key -- Key from getch()
+        width -- Width of the graphs, seeking moves by half of it
+        """
+        if key == ord(' '):
+            self.paused = not self.paused
+        elif key == ord('f'):
+            self.speed = self.speed * 2 if self.speed < MAX_SPEED else 1
+        elif key == ord('+'):
+            self.zoom = max(1, self.zoom // 2)
+        elif key == ord('-'):
+            self.zoom = min(self.zoom * 2, max(1, self.end - self.begin))
+        elif key == ord('z'):
+            self.FitRange(width)
+        elif key == curses.KEY_LEFT:
+            self.Seek(self.position - max(1, width * self.zoom // 2))
+        elif key == curses.KEY_RIGHT:
+            self.Seek(self.position + max(1, width * self.zoom // 2))
+        elif key == curses.KEY_HOME:
+            self.Seek(self.begin + 1)
+        elif key == curses.KEY_END:
+            self.Seek(self.end)
+        else:
+            return False
+        self.generation += 1
+        return True
+
+    def Status(self):
+        """ Return the replay position and controls for the menu line """
+        seconds = self.timestamps[self.position - 1] - self.timestamps[0]
+        state = 'PAUSED' if self.paused else 'x%d' % self.speed
+        return ('%s +%.1fs %s zoom:%d  space:Pause f:Speed +/-:Zoom z:Fit <-/->:Seek' %
+                (time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(self.timestamps[self.position - 1])),
+                 seconds, state, self.zoom))
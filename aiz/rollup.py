@@ -0,0 +1,149 @@
+import numpy as np
+from aiz.history import RingBuffer, metricValue
+
+
+# Downsampled tiers, as (bucket length in seconds, label), each one fed by the tier before it
+TIERS = [(1.0, '1s'), (10.0, '10s'), (60.0, '1m')]
+# Buckets kept in each tier, 512 one minute buckets cover 8.5 hours
+ROLLUP_SAMPLES = 512
+
+
+class RollupTier:
+    """ min/mean/max of every column over fixed length time buckets
+
+    Samples are folded into the open bucket as they arrive, and a bucket is
+    appended to the histories when the first sample past its end shows up.
+
+    Parameters:
+    seconds -- Bucket length
+    label -- Name of the time scale
+    columns -- Number of columns
+    capacity -- Number of buckets kept
+    """
+    def __init__(self, seconds, label, columns, capacity):
+        self.seconds = seconds
+        self.label = label
+        self.min = RingBuffer(capacity, dtype=np.float32, shape=(columns,))
+        self.mean = RingBuffer(capacity, dtype=np.float32, shape=(columns,))
+        self.max = RingBuffer(capacity, dtype=np.float32, shape=(columns,))
+        self.bucketMin = np.full(columns, np.inf)
+        self.bucketMax = np.full(columns, -np.inf)
+        self.bucketSum = np.zeros(columns)
+        self.bucketCount = 0
+        self.start = None
+
+    def close(self):
+        """ Append the open bucket, returns it as (start, min, max, sum, count) for the next tier """
+        mean = self.bucketSum / self.bucketCount
+        self.min.Append(self.bucketMin)
+        self.mean.Append(mean)
+        self.max.Append(self.bucketMax)
+        closed = (self.start, self.bucketMin.copy(), self.bucketMax.copy(), self.bucketSum.copy(), self.bucketCount)
+        self.bucketMin.fill(np.inf)
+        self.bucketMax.fill(-np.inf)
+        self.bucketSum.fill(0.0)
+        self.bucketCount = 0
+        return closed
+
+    def Add(self, timestamp, low, high, total, count):
+        """ Fold samples into the open bucket, returns the bucket it closed or None
+
+        Parameters:
+        timestamp -- Time of the samples, or start of the bucket of the tier below
+        low -- Minimum of each column
+        high -- Maximum of each column
+        total -- Sum of each column
+        count -- Number of samples summed
+        """
+        closed = None
+        start = (timestamp // self.seconds) * self.seconds
+        if self.start is not None and start != self.start and self.bucketCount:
+            closed = self.close()
+        self.start = start
+        np.minimum(self.bucketMin, low, out=self.bucketMin)
+        np.maximum(self.bucketMax, high, out=self.bucketMax)
+        self.bucketSum += total
+        self.bucketCount += count
+        return closed
+
+
+class RollupHistory:
+    """ One column of a tier, read like a RingBuffer of bucket means """
+    def __init__(self, tier, column):
+        self.tier = tier
+        self.column = column
+
+    @property
+    def count(self):
+        return self.tier.mean.count
+
+    def Last(self, n=None):
+        return self.tier.mean.Last(n)[:, self.column]
+
+    def Latest(self):
+        return self.tier.mean.Latest()[self.column]
+
+
+class RollupDevice:
+    """ Stand-in for a live device, with the histories of a tier and every other attribute of the device """
+    def __init__(self, device, tier, columns):
+        self.device = device
+        for name, column in columns.items():
+            setattr(self, name, RollupHistory(tier, column))
+
+    def __getattr__(self, name):
+        # Event markers are placed by raw sample count, they don't line up with buckets
+        if name == 'events':
+            raise AttributeError(name)
+        return getattr(self.device, name)
+
+
+class Rollups:
+    """ Tiered history of every device metric, kept for the whole run in constant memory
+
+    Every sample costs a few vector operations on the 1 s tier, longer
+    tiers are only updated when the tier below closes a bucket. The t key
+    switches the displayed devices between the raw histories and each tier.
+
+    Parameters:
+    devices -- Devices found by DetectHardware()
+    select -- Function called with the devices to display after a switch
+    capacity -- Buckets kept in each tier
+    """
+    def __init__(self, devices, select, capacity=ROLLUP_SAMPLES):
+        self.devices = devices
+        self.select = select
+        self.columns = []
+        deviceColumns = []
+        for device in devices:
+            columns = {}
+            for name in device.METRICS:
+                if isinstance(getattr(device, name), RingBuffer):
+                    columns[name] = len(self.columns)
+                    self.columns.append((device, name))
+            deviceColumns.append(columns)
+        self.tiers = [RollupTier(seconds, label, len(self.columns), capacity) for seconds, label in TIERS]
+        self.views = [[RollupDevice(devices[i], tier, deviceColumns[i]) for i in range(0, len(devices))] for tier in self.tiers]
+        self.row = np.zeros(len(self.columns))
+        # 0 for the raw histories, tier index + 1 otherwise
+        self.scale = 0
+
+    def Update(self, timestamp):
+        """ Sampler listener, folds the newest value of every history into the tiers """
+        for i in range(0, len(self.columns)):
+            self.row[i] = metricValue(self.columns[i][0], self.columns[i][1])
+        bucket = (timestamp, self.row, self.row, self.row, 1)
+        for tier in self.tiers:
+            bucket = tier.Add(*bucket)
+            if bucket is None:
+                break
+
+    def HandleKey(self, key, width):
+        if key != ord('t'):
+            return False
+        self.scale = (self.scale + 1) % (len(self.tiers) + 1)
+        self.select(self.devices if self.scale == 0 else self.views[self.scale - 1])
+        return True
+
+    def Status(self):
+        return 't:Scale %s' % ('raw' if self.scale == 0 else self.tiers[self.scale - 1].label)
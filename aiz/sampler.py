@@ -0,0 +1,153 @@
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+from aiz.history import RingBuffer
+
+
+DEFAULT_INTERVAL = 0.01
+# Interval of adaptive sampling while the watched metrics are flat
+DEFAULT_IDLE_INTERVAL = 0.25
+# Most threads sampling devices in parallel
+MAX_WORKERS = 8
+# Smallest change between two samples that counts as activity, by metric
+ACTIVITY_THRESHOLDS = {
+    'gpu_usage' : 10.0,
+    'pcie_bw' : 500.0,
+    'cpu_usage' : 10.0,
+}
+# Time kept at the fast rate after the last change, in seconds
+ACTIVITY_HOLD = 2.0
+
+
+def sampleDevice(device):
+    device.Sample()
+
+
+class ActivityDetector:
+    """ Picks the time to the next sampler pass from how fast the watched metrics move
+
+    Every pass compares the two newest samples of each watched history. A
+    change above its threshold switches to the fast interval, which is kept
+    until ACTIVITY_HOLD passes without one, then sampling drops back to the
+    slow interval. Short stalls and spikes are caught by the first slow
+    sample that differs, and everything after them is sampled in detail.
+
+    Parameters:
+    devices -- Devices sampled by the Sampler
+    fast -- Interval while the metrics move, in seconds
+    slow -- Interval while they are flat, in seconds
+    thresholds -- Metric name -> smallest change counted as activity
+    hold -- Time kept at the fast interval after the last change, in seconds
+    """
+    def __init__(self, devices, fast, slow, thresholds=ACTIVITY_THRESHOLDS, hold=ACTIVITY_HOLD):
+        self.fast = fast
+        self.slow = max(fast, slow)
+        self.hold = hold
+        self.watched = []
+        for device in devices:
+            for name, threshold in thresholds.items():
+                history = getattr(device, name, None)
+                if isinstance(history, RingBuffer):
+                    self.watched.append((history, threshold))
+        self.lastChange = None
+        self.active = False
+
+    def Interval(self, now):
+        """ Return the time to the next pass, called after every pass
+
+        Parameters:
+        now -- time.monotonic() of the end of the pass
+        """
+        for history, threshold in self.watched:
+            if history.count < 2:
+                continue
+            previous, latest = history.Last(2)
+            if abs(latest - previous) >= threshold:
+                self.lastChange = now
+                break
+        self.active = self.lastChange is not None and now - self.lastChange < self.hold
+        return self.fast if self.active else self.slow
+
+
+class Sampler(threading.Thread):
+    """ Background thread sampling every device at a fixed interval
+
+    The display only reads the histories filled by this thread, so the
+    sample rate is independent from the redraw rate and a slow NVML or
+    sysfs read never stalls the UI.
+
+    Devices are sampled in parallel by a small pool when there are more
+    than two of them. Each device is only touched by one worker per pass,
+    and NVML calls and file reads release the GIL, so the pass takes about
+    as long as the slowest device instead of the sum of all of them.
+
+    With an idle interval the rate adapts to the signal, see
+    ActivityDetector, so passes are no longer evenly spaced. The listeners
+    get the time of each pass, the graphs stay one column per sample.
+
+    Parameters:
+    devices -- Devices whose Sample() is called on every pass
+    interval -- Time between the start of two passes, in seconds
+    workers -- Number of sampling threads, None picks one per device up to MAX_WORKERS, 1 samples in order
+    idleInterval -- Interval while the metrics are flat, None samples at a fixed interval
+    """
+    def __init__(self, devices, interval=DEFAULT_INTERVAL, workers=None, idleInterval=None):
+        threading.Thread.__init__(self, name='aiz-sampler', daemon=True)
+        self.devices = devices
+        self.interval = interval
+        self.activity = None
+        if idleInterval is not None:
+            self.activity = ActivityDetector(devices, interval, idleInterval)
+        if workers is None:
+            workers = min(MAX_WORKERS, len(devices)) if len(devices) > 2 else 1
+        self.pool = None
+        if workers > 1:
+            self.pool = ThreadPoolExecutor(max_workers=workers, thread_name_prefix='aiz-sample')
+        # Number of completed passes, lets readers tell when new samples arrived
+        self.generation = 0
+        # Exception that stopped the thread, re-raised by the main loop
+        self.error = None
+        # Functions called with the pass timestamp after every pass
+        self.listeners = []
+        self.stopEvent = threading.Event()
+
+    def AddListener(self, listener):
+        """ Call listener(timestamp) on the sampler thread after every pass """
+        self.listeners.append(listener)
+
+    def SampleOnce(self):
+        timestamp = time.time()
+        if self.pool:
+            # list() waits for every device, and raises the first exception
+            list(self.pool.map(sampleDevice, self.devices))
+        else:
+            for device in self.devices:
+                device.Sample()
+        self.generation += 1
+        for listener in self.listeners:
+            listener(timestamp)
+
+    def run(self):
+        deadline = time.monotonic()
+        try:
+            while not self.stopEvent.is_set():
+                self.SampleOnce()
+                if self.activity:
+                    deadline += self.activity.Interval(time.monotonic())
+                else:
+                    deadline += self.interval
+                delay = deadline - time.monotonic()
+                if delay < 0:
+                    # The pass took longer than the interval, don't try to catch up
+                    deadline = time.monotonic()
+                    delay = 0
+                self.stopEvent.wait(delay)
+        except Exception as e:
+            self.error = e
+
+    def Stop(self):
+        self.stopEvent.set()
+        if self.is_alive():
+            self.join()
+        if self.pool:
+            self.pool.shutdown()
@@ -0,0 +1,120 @@
+import curses
+
+
+class Lines:
+    """ Lines of (text, attr) segments, built with the same addstr()/addch() calls as a curses window
+
+    Parameters:
+    win -- Optional curses window, getmaxyx() reports its size
+    """
+    def __init__(self, win=None):
+        self.lines = [[]]
+        self.win = win
+
+    def getmaxyx(self):
+        return self.win.getmaxyx()
+
+    def addstr(self, text, attr=0):
+        parts = text.split('\n')
+        for i in range(0, len(parts)):
+            if i > 0:
+                self.lines.append([])
+            if parts[i]:
+                self.lines[-1].append((parts[i], attr))
+
+    def addch(self, ch, attr=0):
+        self.addstr(ch, attr)
+
+
+def drawLines(win, lines):
+    """ Draw Lines from the current line of a window or Lines, like the calls that built them """
+    for y in range(0, len(lines.lines)):
+        if y > 0:
+            win.addch('\n')
+        for text, attr in lines.lines[y]:
+            win.addstr(text, attr)
+
+def drawTiles(win, tiles, width):
+    """ Draw Lines side by side, each one cut or padded to width columns
+
+    Parameters:
+    win -- Window or Lines drawn to, from the start of its current line
+    tiles -- Lines of each tile, left to right
+    width -- Columns of a tile, including the one left empty as a gap
+    """
+    height = max(len(tile.lines) for tile in tiles)
+    for y in range(0, height):
+        if y > 0:
+            win.addch('\n')
+        for i in range(0, len(tiles)):
+            x = 0
+            if y < len(tiles[i].lines):
+                for text, attr in tiles[i].lines[y]:
+                    text = text[:width - 1 - x]
+                    if not text:
+                        break
+                    win.addstr(text, attr)
+                    x += len(text)
+            if i < len(tiles) - 1:
+                win.addstr(' ' * (width - x))
+
+
+class FrameBuffer(Lines):
+    """ Off-screen frame drawn with the same addstr()/addch() calls as a curses window
+
+    Flush() compares the frame with the one last shown and only rewrites the
+    lines that changed, then sends them with noutrefresh()/doupdate(). The
+    screen is never cleared, so a frame that didn't change costs no output.
+
+    Parameters:
+    win -- curses window the frame is flushed to
+    """
+    def __init__(self, win):
+        Lines.__init__(self, win)
+        self.previous = []
+        # Lines drawn after the main section, like the shown panels, for it to leave room for
+        self.reserved = 0
+
+    def Invalidate(self):
+        """ Forget the last frame, so the next Flush() redraws every line """
+        self.previous = []
+        self.win.erase()
+
+    def Flush(self):
+        height, width = self.win.getmaxyx()
+        lines = [tuple(line) for line in self.lines[:height]]
+        lines.extend([()] * (height - len(lines)))
+        for y in range(0, height):
+            line = lines[y]
+            if y < len(self.previous) and self.previous[y] == line:
+                continue
+            self.win.move(y, 0)
+            self.win.clrtoeol()
+            # Stop one column short, curses fails on writes to the bottom right cell
+            x = 0
+            for text, attr in line:
+                text = text[:width - 1 - x]
+                if not text:
+                    break
+                self.win.addstr(y, x, text, attr)
+                x += len(text)
+
+        self.previous = lines
+        self.lines = [[]]
+        self.win.noutrefresh()
+        curses.doupdate()
+
+
+class Panel:
+    """ Optional section drawn below the device stats, toggled by a key shown in the menu
+
+    Parameters:
+    key -- Character toggling the panel
+    title -- Menu label
+    draw -- Function drawing the panel, called with (win, curses)
+    """
+    def __init__(self, key, title, draw):
+        self.key = key
+        self.title = title
+        self.draw = draw
+        self.shown = False
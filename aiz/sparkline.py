@@ -0,0 +1,51 @@
+import weakref
+import numpy as np
+
+
+# Cell characters by eighths, from empty to full, as UTF-32 code points
+BLOCKS = np.array([ord(c) for c in u' ▁▂▃▄▅▆▇█'], dtype='<u4')
+
+# history -> [count, width, scale, rows, code point buffer, level buffer] of its last rendering
+cache = weakref.WeakKeyDictionary()
+
+
+def renderSparkline(history, width, lines=2, minimum=0.0, maximum=100.0):
+    """ Return the rows of a sparkline of the newest samples of a history, top row first
+
+    Samples are quantized to eighths of a cell with numpy and mapped to
+    block characters through BLOCKS, then each row is decoded from UTF-32
+    in one call. Histories with a sample count, like RingBuffer, are only
+    rendered again when it changes, and reuse their buffers when they do.
+
+    Parameters:
+    history -- RingBuffer, or any object with Last(n)
+    width -- Number of samples, one per column
+    lines -- Height of the sparkline in rows
+    minimum -- Value of an empty column
+    maximum -- Value of a full column
+    """
+    count = getattr(history, 'count', None)
+    scale = (lines, minimum, maximum)
+    entry = cache.get(history) if count is not None else None
+    if entry and entry[0] == count and entry[1] == width and entry[2] == scale:
+        return entry[3]
+
+    values = np.nan_to_num(np.asarray(history.Last(width), dtype=np.float64))
+    n = len(values)
+    if entry and entry[4].shape == (lines, n):
+        codes, levels = entry[4], entry[5]
+    else:
+        codes = np.empty((lines, n), dtype='<u4')
+        levels = np.empty(n, dtype=np.intp)
+    eighths = 8 * lines
+    np.rint((values - minimum) * (eighths / (maximum - minimum)), out=values)
+    np.clip(values, 0, eighths, out=values)
+    for row in range(0, lines):
+        # Eighths above the bottom of this row, clipped to the row
+        np.subtract(values, (lines - 1 - row) * 8, out=levels, casting='unsafe')
+        np.clip(levels, 0, 8, out=levels)
+        np.take(BLOCKS, levels, out=codes[row])
+    rows = [codes[row].tobytes().decode('utf-32-le') for row in range(0, lines)]
+    if count is not None:
+        cache[history] = [count, width, scale, rows, codes, levels]
+    return rows
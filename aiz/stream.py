@@ -0,0 +1,102 @@
+import os
+import json
+import time
+from aiz.history import metricValue
+
+
+STREAM_FORMATS = ['json', 'csv']
+
+# Lines are written in batches of at most this many, or this many seconds
+STREAM_RECORDS = 64
+STREAM_SECONDS = 0.25
+
+
+def columnNames(devices):
+    """ Return the name of every metric column as (device key, metric), gpu0..gpuN then cpu
+
+    Parameters:
+    devices -- Devices found by DetectHardware(), the CPU last
+    """
+    names = []
+    for i in range(0, len(devices)):
+        key = 'cpu' if i == len(devices) - 1 else 'gpu%d' % i
+        for name in devices[i].METRICS:
+            names.append((key, name))
+    return names
+
+
+class Streamer:
+    """ Write the newest value of every device metric to a pipe after each sampler pass
+
+    Every pass becomes one JSON object per line, or one CSV row after a
+    header row. Lines are joined and written with a single write per
+    batch, so a consumer reading at 100 Hz costs a few syscalls a second.
+
+    Parameters:
+    fd -- File descriptor written to, usually stdout
+    devices -- Devices found by DetectHardware(), the CPU last
+    format -- One of STREAM_FORMATS
+    stop -- Function called when the reader closed the pipe
+    records -- Most lines buffered before a write
+    seconds -- Most time a line stays buffered
+    """
+    def __init__(self, fd, devices, format, stop=None, records=STREAM_RECORDS, seconds=STREAM_SECONDS):
+        self.fd = fd
+        self.format = format
+        self.stop = stop
+        self.records = max(1, records)
+        self.seconds = seconds
+        self.columns = []
+        for device in devices:
+            for name in device.METRICS:
+                self.columns.append((device, name))
+        names = columnNames(devices)
+        if format == 'json':
+            # Keys are encoded once, each line only formats the values
+            self.keys = [json.dumps('%s.%s' % name) + ':' for name in names]
+            self.null = 'null'
+        else:
+            self.keys = None
+            self.null = ''
+        self.lines = []
+        self.lastFlush = time.monotonic()
+        self.broken = False
+        if format == 'csv':
+            self.lines.append(','.join(['monotonic', 'time'] + ['%s.%s' % name for name in names]) + '\n')
+
+    def formatValue(self, value):
+        # NaN and infinities have no JSON spelling, and are only false here
+        return '%.6g' % value if value - value == 0.0 else self.null
+
+    def Record(self, timestamp):
+        """ Sampler listener, adds one line """
+        if self.broken:
+            return
+        now = time.monotonic()
+        values = [self.formatValue(metricValue(device, name)) for device, name in self.columns]
+        if self.keys:
+            fields = ['"monotonic":%.6f' % now, '"time":%.6f' % timestamp]
+            fields.extend([self.keys[i] + values[i] for i in range(0, len(values))])
+            self.lines.append('{' + ','.join(fields) + '}\n')
+        else:
+            self.lines.append('%.6f,%.6f,' % (now, timestamp) + ','.join(values) + '\n')
+        if len(self.lines) >= self.records or now - self.lastFlush >= self.seconds:
+            self.Flush()
+
+    def Flush(self):
+        self.lastFlush = time.monotonic()
+        if not self.lines or self.broken:
+            return
+        data = ''.join(self.lines).encode()
+        self.lines = []
+        try:
+            while data:
+                data = data[os.write(self.fd, data):]
+        except BrokenPipeError:
+            # The consumer went away, like head or a restarted producer
+            self.broken = True
+            if self.stop:
+                self.stop()
+
+    def Close(self):
+        self.Flush()
@@ -0,0 +1,36 @@
+import os
+
+
+class SysfsFile:
+    """ A sysfs attribute that stays open between reads.
+
+    sysfs regenerates the contents of an attribute on every read at offset 0,
+    so the file is opened once and re-read with pread instead of being
+    reopened on each sample.
+
+    Parameters:
+    path -- Path of the sysfs attribute
+    size -- Maximum number of bytes returned by a read (sysfs attributes are bounded by PAGE_SIZE)
+    """
+    def __init__(self, path, size=4096):
+        self.path = path
+        self.size = size
+        self.fd = os.open(path, os.O_RDONLY)
+
+    def Read(self):
+        """ Return the contents of the attribute as a string. Raises OSError on failure """
+        return os.pread(self.fd, self.size, 0).decode()
+
+    def ReadInto(self, buffer):
+        """ Read a binary attribute into a preallocated buffer, returns the number of bytes. Raises OSError on failure """
+        if not hasattr(os, 'preadv'):
+            # Python 3.6 has no preadv, the bytes are copied into the buffer
+            data = os.pread(self.fd, len(buffer), 0)
+            buffer[:len(data)] = data
+            return len(data)
+        return os.preadv(self.fd, [buffer], 0)
+
+    def Close(self):
+        if self.fd is not None:
+            os.close(self.fd)
+            self.fd = None
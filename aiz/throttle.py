@@ -0,0 +1,33 @@
+# Clock throttle reasons, as the NVML bitmask. Backends without such a
+# mask report the reasons they can infer with the same bits.
+THROTTLE_GPU_IDLE = 0x1
+THROTTLE_APPLICATIONS_CLOCKS = 0x2
+THROTTLE_SW_POWER_CAP = 0x4
+THROTTLE_HW_SLOWDOWN = 0x8
+THROTTLE_SYNC_BOOST = 0x10
+THROTTLE_SW_THERMAL = 0x20
+THROTTLE_HW_THERMAL = 0x40
+THROTTLE_HW_POWER_BRAKE = 0x80
+
+# Reasons that do not slow a busy GPU down
+IDLE_THROTTLE_REASONS = THROTTLE_GPU_IDLE | THROTTLE_APPLICATIONS_CLOCKS
+
+# Header line labels, in display order
+THROTTLE_LABELS = [
+    (THROTTLE_SW_POWER_CAP | THROTTLE_HW_POWER_BRAKE, 'PWR'),
+    (THROTTLE_SW_THERMAL | THROTTLE_HW_THERMAL, 'THRM'),
+    (THROTTLE_HW_SLOWDOWN, 'HW'),
+    (THROTTLE_SYNC_BOOST, 'SYNC'),
+]
+
+
+def throttleLabel(reasons):
+    """ Return the labels of the active throttle reasons, like 'PWR THRM', empty if the clocks are not held back """
+    reasons = int(reasons)
+    return ' '.join(label for mask, label in THROTTLE_LABELS if reasons & mask)
+
+def clockPercent(current, maximum):
+    """ Return a clock as a percentage of its maximum """
+    if not maximum or current is None:
+        return 0.0
+    return min(100.0, 100.0 * current / maximum)
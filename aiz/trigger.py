@@ -0,0 +1,217 @@
+import os
+import re
+import math
+import time
+from collections import deque
+import numpy as np
+from aiz.history import RingBuffer, metricValue
+from aiz.record import recordHeader, recordDtype, encodeHeader
+
+
+# Default time captured before and after a trigger fires, in seconds
+DEFAULT_PRE_SECONDS = 5.0
+DEFAULT_POST_SECONDS = 5.0
+# Most samples kept by the pre-trigger buffer, whatever the interval
+MAX_CAPTURE_SAMPLES = 100000
+# Timeline marker of a fired trigger, and the events kept for GPUs without a timeline
+EVENT_TRIGGER = '!'
+MAX_EVENTS = 256
+
+# [gpuN.|cpu.]metric < <= > >= value[% of link][ for N ms|s]
+CONDITION = re.compile(r'^(?:(gpu\d+|cpu)\.)?(\w+)\s*(<=|>=|<|>)\s*([0-9]*\.?[0-9]+)\s*(%)?\s*(of\s+link)?'
+                       r'(?:\s+for\s+([0-9]*\.?[0-9]+)\s*(ms|s))?$')
+CONDITION_SEPARATOR = re.compile(r'\s+(?:while|and)\s+')
+COMPARISONS = {
+    '<' : lambda value, threshold: value < threshold,
+    '<=' : lambda value, threshold: value <= threshold,
+    '>' : lambda value, threshold: value > threshold,
+    '>=' : lambda value, threshold: value >= threshold,
+}
+
+
+class Condition:
+    """ One comparison of a trigger, like 'gpu_usage < 30 for 200 ms'
+
+    Parameters:
+    text -- Condition as written on the command line
+    """
+    def __init__(self, text):
+        match = CONDITION.match(text.strip())
+        if not match:
+            raise ValueError('Bad trigger condition: %s' % text)
+        self.text = text.strip()
+        self.device, self.metric, self.operator, value, percent, ofLink, duration, unit = match.groups()
+        self.compare = COMPARISONS[self.operator]
+        self.value = float(value)
+        # Threshold in % of the PCIe link bandwidth of the device, '%' alone would read like it scales the value
+        self.ofLink = ofLink is not None
+        if percent and not self.ofLink:
+            raise ValueError("'%%' needs 'of link' in trigger condition: %s" % text)
+        if self.ofLink and self.metric != 'pcie_bw':
+            raise ValueError("'of link' only applies to pcie_bw: %s" % text)
+        self.duration = 0.0
+        if duration:
+            self.duration = float(duration) / (1000.0 if unit == 'ms' else 1.0)
+
+
+class Trigger:
+    """ Conditions that all have to hold on the same GPU, joined by 'while' or 'and'
+
+    A condition without a device applies to each GPU in turn, or to the CPU
+    for CPU metrics, so 'gpu_usage < 30 while cpu_usage > 90' fires when
+    any GPU idles while the CPU is saturated. The trigger fires when the
+    conditions start holding together, and only again after they stopped.
+
+    Parameters:
+    text -- Trigger expression
+    """
+    def __init__(self, text):
+        self.text = text
+        self.conditions = [Condition(part) for part in CONDITION_SEPARATOR.split(text.strip()) if part]
+        if not self.conditions:
+            raise ValueError('Empty trigger')
+        # Per scope: (GPU or None, [(value function, threshold)], time each condition started holding, fired)
+        self.scopes = []
+
+    def Bind(self, gpus, cpu):
+        """ Resolve the metrics of every condition on the detected devices """
+        named = dict(('gpu%d' % i, gpus[i]) for i in range(0, len(gpus)))
+        named['cpu'] = cpu
+        perGpu = any(condition.device is None and condition.metric not in cpu.METRICS for condition in self.conditions)
+        for gpu in (gpus if perGpu else [None]):
+            bound = []
+            for condition in self.conditions:
+                if condition.device is not None:
+                    if condition.device not in named:
+                        raise ValueError('Unknown device in trigger: %s' % condition.text)
+                    device = named[condition.device]
+                else:
+                    device = cpu if condition.metric in cpu.METRICS else gpu
+                if condition.metric not in device.METRICS:
+                    raise ValueError('Unknown metric in trigger: %s' % condition.text)
+                threshold = condition.value
+                if condition.ofLink:
+                    # pcie_bw sums both directions, the busier one is compared to the bandwidth of the link,
+                    # pcie_tx and pcie_rx already are in % of it. An unknown link never matches
+                    if getattr(device, 'pcie_link_bw', 0) > 0:
+                        value = lambda device=device: max(metricValue(device, 'pcie_tx'), metricValue(device, 'pcie_rx'))
+                    else:
+                        value, threshold = (lambda: 0.0), math.nan
+                else:
+                    value = lambda device=device, metric=condition.metric: metricValue(device, metric)
+                bound.append((value, threshold))
+            self.scopes.append([gpu, bound, [None] * len(bound), False])
+
+    def Update(self, timestamp):
+        """ Return the scopes that started matching at this sample, as a list of GPUs or None """
+        fired = []
+        for scope in self.scopes:
+            bound, since = scope[1], scope[2]
+            holding = True
+            for i in range(0, len(bound)):
+                value, threshold = bound[i]
+                if self.conditions[i].compare(value(), threshold):
+                    if since[i] is None:
+                        since[i] = timestamp
+                    if timestamp - since[i] < self.conditions[i].duration:
+                        holding = False
+                else:
+                    since[i] = None
+                    holding = False
+            if holding and not scope[3]:
+                fired.append(scope[0])
+            scope[3] = holding
+        return fired
+
+
+class TriggerCapture:
+    """ Pre-trigger ring buffer of every metric, saved around each trigger that fires
+
+    Every sampler pass adds one record to a ring buffer covering the
+    window before and after a trigger. When a trigger fires, it is marked
+    on the event timeline of its GPUs, and once the window after it has
+    been sampled the whole window is written as a recording that --replay
+    opens, with the trigger in its header. Nothing is written otherwise.
+
+    Parameters:
+    triggers -- Trigger objects
+    gpus -- GPU devices found by DetectHardware()
+    cpu -- CPU device found by DetectHardware()
+    interval -- Sampling interval in seconds
+    directory -- Directory the captures are written to
+    pre -- Time captured before a trigger, in seconds
+    post -- Time captured after a trigger, in seconds
+    """
+    def __init__(self, triggers, gpus, cpu, interval, directory='.', pre=DEFAULT_PRE_SECONDS, post=DEFAULT_POST_SECONDS):
+        self.triggers = triggers
+        self.gpus = gpus
+        self.directory = directory
+        self.pre = pre
+        self.post = post
+        devices = gpus + [cpu]
+        for trigger in triggers:
+            trigger.Bind(gpus, cpu)
+        for gpu in gpus:
+            if not hasattr(gpu, 'events'):
+                gpu.events = deque(maxlen=MAX_EVENTS)
+        self.header = recordHeader(devices, interval)
+        self.columns = []
+        for device in devices:
+            for name in device.METRICS:
+                self.columns.append((device, name))
+        capacity = int(math.ceil((pre + post) / max(interval, 0.001))) + 16
+        self.records = RingBuffer(min(MAX_CAPTURE_SAMPLES, capacity), dtype=recordDtype(self.header))
+        self.record = np.zeros(1, dtype=self.records.data.dtype)[0]
+        # Fired triggers waiting for the end of their window, as (trigger, GPU or None, timestamp)
+        self.pending = []
+        self.fired = 0
+        self.lastPath = None
+
+    def Record(self, timestamp):
+        """ Sampler listener, adds one record and checks the triggers """
+        self.record['timestamp'] = timestamp
+        values = self.record['values']
+        for i in range(0, len(self.columns)):
+            values[i] = metricValue(self.columns[i][0], self.columns[i][1])
+        self.records.Append(self.record)
+
+        for trigger in self.triggers:
+            # One capture at a time per trigger
+            if any(pending[0] is trigger for pending in self.pending):
+                continue
+            fired = trigger.Update(timestamp)
+            if fired:
+                self.fired += 1
+                self.pending.append((trigger, fired[0], timestamp))
+                for gpu in (self.gpus if fired[0] is None else fired):
+                    gpu.events.append((gpu.gpu_usage.count, EVENT_TRIGGER, 'Trigger: %s' % trigger.text))
+
+        while self.pending and timestamp - self.pending[0][2] >= self.post:
+            self.save(*self.pending.pop(0))
+
+    def save(self, trigger, gpu, fired):
+        records = self.records.Last(min(self.records.count, len(self.records)))
+        records = records[records['timestamp'] >= fired - self.pre]
+        header = dict(self.header)
+        header['start'] = float(records['timestamp'][0]) if len(records) else fired
+        header['trigger'] = {'expression' : trigger.text, 'time' : fired,
+                             'gpu' : self.gpus.index(gpu) if gpu is not None else None}
+        name = 'aiz-trigger-%s-%d.aiz' % (time.strftime('%Y%m%d-%H%M%S', time.localtime(fired)), self.fired)
+        path = os.path.join(self.directory, name)
+        with open(path, 'wb') as f:
+            f.write(encodeHeader(header))
+            f.write(records.tobytes())
+        self.lastPath = path
+
+    def HandleKey(self, key, width):
+        return False
+
+    def Status(self):
+        if not self.fired:
+            return 'Triggers armed'
+        return 'Triggered %d, %s' % (self.fired, os.path.basename(self.lastPath) if self.lastPath else 'capturing')
+
+    def Close(self):
+        """ Save the triggers still waiting for the end of their window """
+        while self.pending:
+            self.save(*self.pending.pop(0))
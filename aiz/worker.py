@@ -0,0 +1,39 @@
+import threading
+import time
+import logging
+
+
+class AsyncReader(threading.Thread):
+    """ Daemon thread repeating a slow read at its own cadence
+
+    value always holds the result of the last completed read, so a sampler
+    can use it without waiting on the read itself. A failed read is logged
+    and keeps the previous value.
+
+    Parameters:
+    name -- Thread name
+    read -- Function performing the read, its result is stored in value
+    interval -- Minimum time between the start of two reads, in seconds
+    default -- value until the first read completes
+    """
+    def __init__(self, name, read, interval, default=None):
+        threading.Thread.__init__(self, name=name, daemon=True)
+        self.read = read
+        self.interval = interval
+        self.value = default
+        # Number of completed reads
+        self.count = 0
+        self.stopEvent = threading.Event()
+
+    def run(self):
+        while not self.stopEvent.is_set():
+            start = time.monotonic()
+            try:
+                self.value = self.read()
+                self.count += 1
+            except Exception as e:
+                logging.debug('%s: read failed: %s', self.name, e)
+            self.stopEvent.wait(max(0.0, self.interval - (time.monotonic() - start)))
+
+    def Stop(self):
+        self.stopEvent.set()
@@ -13,7 +13,7 @@ setuptools.setup(
     long_description=long_description,
     long_description_content_type="text/markdown",
     url="https://www.ai-z.org",
-    install_requires=['py3nvml','numpy','psutil','py-cpuinfo','sparklines'],
+    install_requires=['py3nvml','numpy','psutil','py-cpuinfo'],
     packages=setuptools.find_packages(),
     scripts=['bin/ai-z'],
     classifiers=[
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#=============================================
+# Sampler overhead benchmark on synthetic hardware
+#
+#   python3 tests/benchmark.py [--passes N] [--gpus 1,8,16]
+#
+# For each backend and GPU count, reports the time of one sampler pass and of
+# one GPU sample, the read/write syscalls of the sampling thread, the net
+# number of allocated blocks left per pass (anything above 0 grows with the
+# run time) and the peak of the memory allocated while sampling.
+# Passes are measured on one thread, the pool line only times the parallel pass.
+# The draw line times DisplayStats() and FrameBuffer.Flush() on a null window.
+#=============================================
+
+import os
+import sys
+import time
+import argparse
+import tracemalloc
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from fixtures import FakeSysfs, InstallFakeNVML, NullWindow, NullCurses
+
+# Has to be installed before aiz.gpu_nvidia imports py3nvml
+MAX_GPUS = 64
+InstallFakeNVML(MAX_GPUS)
+
+import aiz.gpu_amd as gpu_amd
+import aiz.screen as screen
+from aiz.gpu_nvidia import AIZGPU_NVIDIA
+from aiz.cpu import GetCPUDevice
+from aiz.sampler import Sampler
+from aiz.hwinfo import SetDevices, DisplayStats
+
+
+WARMUP_PASSES = 20
+
+
+def syscallCount():
+    """ Return the read and write syscalls made so far by the calling thread, or by the process on older kernels """
+    for path in ['/proc/thread-self/io', '/proc/self/io']:
+        try:
+            with open(path, 'r') as io:
+                fields = dict(line.split(':') for line in io.read().splitlines())
+            return int(fields['syscr']) + int(fields['syscw'])
+        except (OSError, KeyError, ValueError):
+            continue
+    return 0
+
+def measure(function, passes):
+    """ Return (seconds, syscalls, allocated blocks, peak traced bytes) per call of function """
+    for i in range(0, WARMUP_PASSES):
+        function()
+
+    # Reading the counters costs syscalls too, measured once and subtracted
+    calibration = syscallCount()
+    calibration = syscallCount() - calibration
+
+    syscalls = syscallCount()
+    blocks = sys.getallocatedblocks()
+    start = time.perf_counter()
+    for i in range(0, passes):
+        function()
+    seconds = time.perf_counter() - start
+    blocks = sys.getallocatedblocks() - blocks
+    syscalls = syscallCount() - syscalls - calibration
+
+    # Traced separately, tracemalloc slows every allocation down
+    tracemalloc.start()
+    for i in range(0, min(passes, 100)):
+        function()
+    peak = tracemalloc.get_traced_memory()[1]
+    tracemalloc.stop()
+    return (seconds / passes, float(syscalls) / passes, float(blocks) / passes, peak)
+
+def amdDevices(num_gpus):
+    sysfs = FakeSysfs(num_gpus)
+    gpu_amd.setSysfsPrefixes(sysfs.drm, sysfs.hwmon)
+    gpus = gpu_amd.ListAMDGPUDevices(False, identities={})
+    return (gpus, sysfs)
+
+def nvidiaDevices(num_gpus):
+    return ([AIZGPU_NVIDIA(i) for i in range(0, num_gpus)], None)
+
+def closeDevices(gpus, sysfs):
+    for gpu in gpus:
+        if getattr(gpu, 'slowReader', None):
+            gpu.slowReader.Stop()
+        if getattr(gpu, 'sysfs', None):
+            gpu.sysfs.Close()
+    if sysfs:
+        sysfs.Close()
+
+def printRow(name, num_gpus, result):
+    seconds, syscalls, blocks, peak = result
+    print('%-12s %5d %12.1f %10.1f %10.1f %10.2f %10.1f' % (name, num_gpus, seconds * 1e6, seconds * 1e6 / num_gpus,
+                                                         syscalls, blocks, peak / 1024.0))
+
+def printTimeRow(name, num_gpus, seconds):
+    print('%-12s %5d %12.1f %10.1f %10s %10s %10s' % (name, num_gpus, seconds * 1e6, seconds * 1e6 / num_gpus, '-', '-', '-'))
+
+def main(argv):
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--passes', default=2000, type=int, help='measured sampler passes of each configuration')
+    parser.add_argument('--gpus', default='1,8,16', help='comma separated numbers of simulated GPUs')
+    args = parser.parse_args(argv)
+    counts = [min(MAX_GPUS, int(count)) for count in args.gpus.split(',') if count]
+
+    screen.curses = NullCurses
+    cpu = GetCPUDevice()
+
+    print('%-12s %5s %12s %10s %10s %10s %10s' % ('BACKEND', 'GPUS', 'US/PASS', 'US/GPU', 'SYSCALLS', 'BLOCKS', 'PEAK KIB'))
+    for name, create in [('amd', amdDevices), ('nvidia', nvidiaDevices)]:
+        for num_gpus in counts:
+            gpus, sysfs = create(num_gpus)
+            try:
+                sampler = Sampler(gpus, workers=1)
+                printRow(name, num_gpus, measure(sampler.SampleOnce, args.passes))
+                pooled = Sampler(gpus)
+                if pooled.pool:
+                    printTimeRow(name + ' pool', num_gpus, measure(pooled.SampleOnce, args.passes)[0])
+                    pooled.Stop()
+
+                SetDevices(gpus, cpu)
+                frame = screen.FrameBuffer(NullWindow())
+                def render():
+                    # New samples every frame, so Flush() has changed lines to write
+                    sampler.SampleOnce()
+                    DisplayStats(frame, NullCurses)
+                    frame.Flush()
+                sampling = measure(sampler.SampleOnce, args.passes // 10 or 1)
+                rendering = measure(render, args.passes // 10 or 1)
+                printRow(name + ' draw', num_gpus, tuple(rendering[i] - sampling[i] for i in range(0, 3)) + (rendering[3],))
+            finally:
+                closeDevices(gpus, sysfs)
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -0,0 +1,286 @@
+#=============================================
+# Synthetic hardware for tests and benchmarks: a fake DRM/HW Monitor sysfs
+# tree for gpu_amd.py and a fake py3nvml module for gpu_nvidia.py.
+# InstallFakeNVML() has to run before anything imports aiz.gpu_nvidia.
+#=============================================
+
+import os
+import sys
+import math
+import types
+import struct
+import tempfile
+import shutil
+
+
+class FakeSysfs:
+    """ Temporary directory laid out like /sys for a number of amdgpu cards
+
+    Every card is a PCI device directory with a drm/cardN and an amdgpu
+    hwmon/hwmonN child, linked from class/drm and class/hwmon.
+
+    Parameters:
+    num_gpus -- Number of cards
+    """
+    def __init__(self, num_gpus):
+        self.root = tempfile.mkdtemp(prefix='aiz-sysfs-')
+        self.drm = os.path.join(self.root, 'class', 'drm')
+        self.hwmon = os.path.join(self.root, 'class', 'hwmon')
+        os.makedirs(self.drm)
+        os.makedirs(self.hwmon)
+        for i in range(0, num_gpus):
+            self.addCard(i)
+
+    def write(self, path, value):
+        with open(path, 'w') as f:
+            f.write('%s\n' % value)
+
+    def addCard(self, i):
+        device = os.path.join(self.root, 'devices', 'pci0000:00', '0000:%02x:00.0' % (i + 1))
+        card = os.path.join(device, 'drm', 'card%d' % i)
+        hwmon = os.path.join(device, 'hwmon', 'hwmon%d' % i)
+        os.makedirs(card)
+        os.makedirs(hwmon)
+        files = {
+            'vendor' : '0x1002',
+            'device' : '0x73bf',
+            'power_dpm_force_performance_level' : 'auto',
+            'gpu_busy_percent' : 37,
+            'mem_busy_percent' : 12,
+            'mem_info_vram_used' : 4 * 1024 * 1024 * 1024,
+            'mem_info_vram_total' : 16 * 1024 * 1024 * 1024,
+            'pcie_bw' : '1234 5678 256',
+            'pp_dpm_sclk' : '0: 500Mhz\n1: 1800Mhz *\n2: 2500Mhz',
+            'pp_dpm_mclk' : '0: 96Mhz\n1: 1000Mhz *',
+            'max_link_speed' : '16.0 GT/s PCIe',
+            'max_link_width' : 16,
+        }
+        for name, value in files.items():
+            self.write(os.path.join(device, name), value)
+        with open(os.path.join(device, 'gpu_metrics'), 'wb') as f:
+            f.write(gpuMetricsTable(i))
+        hwmonFiles = {
+            'name' : 'amdgpu',
+            'pwm1' : 96,
+            'pwm1_max' : 255,
+            'temp1_input' : 54000,
+            'temp1_crit' : 100000,
+            'power1_average' : 180000000,
+            'power1_cap' : 255000000,
+        }
+        for name, value in hwmonFiles.items():
+            self.write(os.path.join(hwmon, name), value)
+        os.symlink(device, os.path.join(card, 'device'))
+        os.symlink(device, os.path.join(hwmon, 'device'))
+        os.symlink(card, os.path.join(self.drm, 'card%d' % i))
+        os.symlink(hwmon, os.path.join(self.hwmon, 'hwmon%d' % i))
+
+    def Close(self):
+        shutil.rmtree(self.root, ignore_errors=True)
+
+
+class FakeNVMLError(Exception):
+    def __init__(self, value):
+        Exception.__init__(self, value)
+        self.value = value
+
+
+class FakeNVMLDevice:
+    """ State of one simulated NVIDIA GPU, the counters move on every read """
+    def __init__(self, index):
+        self.index = index
+        self.reads = 0
+        self.tx = 0
+        self.rx = 0
+        self.nvlink = 0
+        self.timestamp = 0
+
+    def Usage(self):
+        self.reads += 1
+        return int(50 + 45 * math.sin(self.reads / 10.0 + self.index))
+
+
+def gpuMetricsTable(index):
+    """ Return a gpu_metrics v1.3 table, 120 bytes, with the throttle status reporting a power limit """
+    unsupported = 0xffff
+    table = struct.pack('<HBB6H3HHQQ7H7HIHHHHII4H', 120, 1, 3,
+                        54, 71, 60, unsupported, unsupported, unsupported,
+                        37 + index, 12, 0, 180,
+                        123456789, 987654321,
+                        1790, 1000, 1000, 0, 0, 0, 0,
+                        1800, 1000, 1000, 0, 0, 0, 0,
+                        0, 1500, 16, 160, 0, 0, 0,
+                        unsupported, unsupported, unsupported, unsupported)
+    # firmware timestamp, soc, gfx and mem voltages and padding, then the PPT0 throttler bit
+    return table + struct.pack('<Q4HQ', 0, 900, 1050, 1350, 0, 0x1)
+
+def gpuMetricsTableV1_4(seconds, xgmiKB):
+    """ Return a gpu_metrics v1.4 (MI300) table, 284 bytes, with 7 XGMI links that counted xgmiKB each way
+
+    Parameters:
+    seconds -- Driver timestamp of the table
+    xgmiKB -- Value of the read and write accumulators of every counted link
+    """
+    unsupported = 0xffff
+    unsupported64 = 0xffffffffffffffff
+    xgmi = [xgmiKB] * 7 + [unsupported64]
+    return struct.pack('<HBB3HH2H4HQQIIHHHHIIQQQQQ8Q8QQ8H4H4H4HHH', 284, 1, 4,
+                       70, 60, unsupported, 400, 55, 20,
+                       0, 0, 0, 0,
+                       123456789, int(seconds * 1e9), 0, 0,
+                       16, 320, 16, 32, 0, 0,
+                       0, 0, 0, 0, 0,
+                       *(xgmi + xgmi),
+                       0,
+                       2100, 0, 0, 0, 0, 0, 0, 0,
+                       *([0] * 12),
+                       1300, 0)
+
+
+def InstallFakeNVML(num_gpus):
+    """ Register a fake py3nvml module simulating num_gpus GPUs, returns their FakeNVMLDevice states """
+    devices = [FakeNVMLDevice(i) for i in range(0, num_gpus)]
+    nvml = types.ModuleType('py3nvml.py3nvml')
+    nvml.NVMLError = FakeNVMLError
+    nvml.NVML_SUCCESS = 0
+    nvml.NVML_ERROR_NOT_SUPPORTED = 3
+    nvml.NVML_ERROR_NOT_FOUND = 6
+    nvml.NVML_ERROR_INSUFFICIENT_SIZE = 7
+    nvml.NVML_ERROR_TIMEOUT = 10
+    nvml.NVML_TEMPERATURE_GPU = 0
+    nvml.NVML_CLOCK_SM = 1
+    nvml.NVML_CLOCK_MEM = 2
+    nvml.NVML_PCIE_UTIL_TX_BYTES = 0
+    nvml.NVML_PCIE_UTIL_RX_BYTES = 1
+    nvml.nvmlEventTypeXidCriticalError = 0x8
+    nvml.nvmlEventTypeClock = 0x10
+    nvml.nvmlEventTypePState = 0x2
+    # GPUs are NVLinked in pairs, 0 with 1, 2 with 3 and so on
+    nvlinks = 2
+
+    def notSupported(*args):
+        raise FakeNVMLError(nvml.NVML_ERROR_NOT_SUPPORTED)
+
+    def getFieldValues(handle, count, values):
+        device = devices[handle]
+        device.tx += 3 * 1024 * 1024
+        device.rx += 5 * 1024 * 1024
+        # NVLink counters are in KiB, 20 MiB on each link per read
+        device.nvlink += 20 * 1024
+        device.timestamp += 10000
+        for i in range(0, count.value):
+            value = values[i]
+            value.timestamp = device.timestamp
+            if value.fieldId in (197, 198):
+                value.nvmlReturn = 0
+                value.valueType = 3
+                value.value.ullVal = device.tx if value.fieldId == 197 else device.rx
+            elif value.fieldId == 186:
+                value.nvmlReturn = 0
+                value.valueType = 1
+                value.value.uiVal = 250000
+            elif value.fieldId in (138, 139) and value.scopeId < nvlinks:
+                value.nvmlReturn = 0
+                value.valueType = 3
+                value.value.ullVal = device.nvlink
+            else:
+                value.nvmlReturn = nvml.NVML_ERROR_NOT_SUPPORTED
+        return 0
+
+    def getFunctionPointer(name):
+        if name == 'nvmlDeviceGetFieldValues':
+            return getFieldValues
+        return lambda *args: nvml.NVML_ERROR_NOT_FOUND
+
+    def nvlinkPeer(handle):
+        peer = handle ^ 1
+        if peer >= len(devices):
+            raise FakeNVMLError(nvml.NVML_ERROR_NOT_SUPPORTED)
+        return peer
+
+    def nvlinkState(handle, link):
+        nvlinkPeer(handle)
+        if link >= nvlinks:
+            raise FakeNVMLError(nvml.NVML_ERROR_NOT_SUPPORTED)
+        return 1
+
+    nvml._nvmlGetFunctionPointer = getFunctionPointer
+    nvml.nvmlInit = lambda: None
+    nvml.nvmlShutdown = lambda: None
+    nvml.nvmlDeviceGetCount = lambda: len(devices)
+    nvml.nvmlDeviceGetHandleByIndex = lambda i: i
+    nvml.nvmlDeviceGetIndex = lambda handle: handle
+    nvml.nvmlDeviceGetName = lambda handle: 'Fake GPU %d' % handle
+    nvml.nvmlDeviceGetPciInfo = lambda handle: types.SimpleNamespace(busId=b'00000000:%02X:00.0' % (handle + 0x41))
+    nvml.nvmlDeviceGetNvLinkState = nvlinkState
+    nvml.nvmlDeviceGetNvLinkRemotePciInfo = lambda handle, link: nvml.nvmlDeviceGetPciInfo(nvlinkPeer(handle))
+    nvml.nvmlDeviceGetMemoryInfo = lambda handle: types.SimpleNamespace(total=24 * 1024 ** 3, used=6 * 1024 ** 3, free=18 * 1024 ** 3)
+    nvml.nvmlDeviceGetMaxPcieLinkGeneration = lambda handle: 4
+    nvml.nvmlDeviceGetMaxPcieLinkWidth = lambda handle: 16
+    nvml.nvmlDeviceGetUtilizationRates = lambda handle: types.SimpleNamespace(gpu=devices[handle].Usage(), memory=20)
+    nvml.nvmlDeviceGetTemperature = lambda handle, sensor: 61
+    nvml.nvmlDeviceGetFanSpeed = lambda handle: 40
+    nvml.nvmlDeviceGetPcieThroughput = lambda handle, counter: 1024
+    nvml.nvmlDeviceGetComputeRunningProcesses = lambda handle: []
+    nvml.nvmlDeviceGetCurrentClocksThrottleReasons = lambda handle: 0x4 if devices[handle].reads % 50 < 5 else 0
+    nvml.nvmlDeviceGetClockInfo = lambda handle, clock: 1410 if clock == nvml.NVML_CLOCK_SM else 1215
+    nvml.nvmlDeviceGetMaxClockInfo = lambda handle, clock: 1980 if clock == nvml.NVML_CLOCK_SM else 1215
+    nvml.nvmlDeviceGetPowerUsage = lambda handle: 250000
+    nvml.nvmlDeviceGetEnforcedPowerLimit = lambda handle: 300000
+    nvml.nvmlEventSetCreate = notSupported
+    nvml.nvmlEventSetFree = lambda eventSet: None
+
+    package = types.ModuleType('py3nvml')
+    package.py3nvml = nvml
+    sys.modules['py3nvml'] = package
+    sys.modules['py3nvml.py3nvml'] = nvml
+    return devices
+
+
+class NullWindow:
+    """ curses window that drops everything, for timing the render path alone
+
+    Parameters:
+    height -- Number of lines
+    width -- Number of columns
+    """
+    def __init__(self, height=60, width=200):
+        self.height = height
+        self.width = width
+        self.writes = 0
+
+    def getmaxyx(self):
+        return (self.height, self.width)
+
+    def addstr(self, *args):
+        self.writes += 1
+
+    def addch(self, *args):
+        self.writes += 1
+
+    def move(self, y, x):
+        pass
+
+    def clrtoeol(self):
+        pass
+
+    def erase(self):
+        pass
+
+    def noutrefresh(self):
+        pass
+
+
+class NullCurses:
+    """ Stand-in for the curses module passed to the Display functions """
+    COLOR_GREEN = 2
+    COLOR_BLACK = 0
+    A_BOLD = 1 << 21
+
+    @staticmethod
+    def color_pair(n):
+        return n << 8
+
+    @staticmethod
+    def doupdate():
+        pass
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+#=============================================
+# Behavior checks of the pure parts of ai-z: ring buffers, the gpu_metrics
+# decoder, the recording and cluster wire formats, trigger and cgroup parsing
+#
+#   python3 tests/test.py
+#=============================================
+
+import os
+import sys
+import time
+import tempfile
+import unittest
+import numpy as np
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from fixtures import gpuMetricsTable, gpuMetricsTableV1_4
+
+from aiz.history import RingBuffer
+from aiz.amd_metrics import decodeGpuMetrics
+from aiz.throttle import THROTTLE_SW_POWER_CAP
+from aiz.interconnect import LinkCounters
+from aiz.cluster import encodeBatch, decodeBatch
+from aiz.record import Recorder
+from aiz.replay import Replay
+from aiz.trigger import Condition, Trigger
+from aiz.container import parseCpuMax, parsePressure
+
+
+class FakeDevice:
+    """ Device with one history and one plain value, for the recording tests """
+    METRICS = ['gpu_usage', 'power_watts']
+
+    def __init__(self, name):
+        self.name = name
+        self.gpu_usage = RingBuffer(8)
+        self.power_watts = 0.0
+
+
+class RingBufferTest(unittest.TestCase):
+    def testWraparound(self):
+        history = RingBuffer(4)
+        for value in range(0, 6):
+            history.Append(value)
+        self.assertEqual(list(history.Last()), [2, 3, 4, 5])
+        self.assertEqual(list(history.Last(2)), [4, 5])
+        self.assertEqual(history.Latest(), 5)
+        self.assertEqual(history.count, 6)
+
+    def testExtendPastCapacity(self):
+        history = RingBuffer(4)
+        history.Append(-1)
+        history.Extend(np.arange(0, 7))
+        self.assertEqual(list(history.Last()), [3, 4, 5, 6])
+        self.assertEqual(history.count, 8)
+
+    def testRows(self):
+        history = RingBuffer(3, shape=(2,))
+        history.Append([1.0, 2.0])
+        history.Append([3.0, 4.0])
+        self.assertEqual(list(history.Latest()), [3.0, 4.0])
+        self.assertEqual(history.Last(2).shape, (2, 2))
+
+
+class GpuMetricsTest(unittest.TestCase):
+    def decode(self, table):
+        buffer = bytearray(1024)
+        buffer[:len(table)] = table
+        return decodeGpuMetrics(buffer, len(table))
+
+    def testV1_3(self):
+        metrics = self.decode(gpuMetricsTable(0))
+        self.assertEqual(metrics['temp_edge'], 54)
+        self.assertEqual(metrics['temp_hotspot'], 71)
+        self.assertEqual(metrics['gfx_activity'], 37)
+        self.assertEqual(metrics['umc_activity'], 12)
+        self.assertEqual(metrics['socket_power'], 180)
+        self.assertEqual(metrics['gfxclk'], 1800)
+        self.assertEqual(metrics['uclk'], 1000)
+        self.assertEqual(metrics['throttle'], THROTTLE_SW_POWER_CAP)
+        self.assertIsNone(metrics['xgmi'])
+
+    def testV1_4(self):
+        metrics = self.decode(gpuMetricsTableV1_4(2.5, 1000))
+        self.assertIsNone(metrics['temp_edge'])
+        self.assertEqual(metrics['temp_hotspot'], 70)
+        self.assertEqual(metrics['gfx_activity'], 55)
+        self.assertEqual(metrics['umc_activity'], 20)
+        self.assertEqual(metrics['socket_power'], 400)
+        self.assertEqual(metrics['gfxclk'], 2100)
+        self.assertEqual(metrics['uclk'], 1300)
+        self.assertIsNone(metrics['throttle'])
+        self.assertEqual(metrics['xgmi'], [2000] * 7 + [None])
+        self.assertAlmostEqual(metrics['timestamp'], 2.5)
+
+    def testTruncated(self):
+        table = gpuMetricsTable(0)
+        self.assertIsNone(decodeGpuMetrics(bytearray(table), len(table) - 40))
+        self.assertIsNone(decodeGpuMetrics(bytearray(4), 2))
+
+    def testXgmiRates(self):
+        counters = LinkCounters(7, 1024)
+        first = self.decode(gpuMetricsTableV1_4(1.0, 0))
+        second = self.decode(gpuMetricsTableV1_4(1.5, 1024 * 1024))
+        self.assertIsNone(counters.Update(first['xgmi'][:7], first['timestamp']))
+        # 2 GiB over half a second on each link
+        rates = counters.Update(second['xgmi'][:7], second['timestamp'])
+        self.assertEqual(list(rates), [4096.0] * 7)
+
+
+class ClusterWireTest(unittest.TestCase):
+    def testRoundTrip(self):
+        timestamps = np.array([100.0, 100.5, 101.0])
+        rows = np.array([[1, 2, 3], [1, 5, 3], [7, 5, 3]], dtype=np.float32)
+        decodedTimes, decodedRows = decodeBatch(encodeBatch(timestamps, rows, None), None)
+        np.testing.assert_allclose(decodedTimes, timestamps)
+        np.testing.assert_array_equal(decodedRows, rows)
+
+    def testUnchangedValuesCarried(self):
+        previous = np.array([7, 5, 3], dtype=np.float32)
+        timestamps = np.array([102.0, 102.5])
+        rows = np.array([[7, 5, 3], [7, 6, 3]], dtype=np.float32)
+        payload = encodeBatch(timestamps, rows, previous)
+        np.testing.assert_array_equal(decodeBatch(payload, previous)[1], rows)
+
+
+class RecordReplayTest(unittest.TestCase):
+    def testRoundTrip(self):
+        devices = [FakeDevice('gpu'), FakeDevice('other')]
+        handle, path = tempfile.mkstemp(suffix='.aiz')
+        os.close(handle)
+        try:
+            recorder = Recorder(path, devices, 0.5)
+            for i in range(0, 5):
+                devices[0].gpu_usage.Append(10 * i)
+                devices[0].power_watts = 100.0 + i
+                devices[1].gpu_usage.Append(i)
+                recorder.Record(1000.0 + i)
+            recorder.Close()
+
+            replay = Replay(path)
+            self.assertEqual(replay.end, 5)
+            np.testing.assert_allclose(replay.timestamps, [1000.0 + i for i in range(0, 5)])
+            replay.Seek(5)
+            gpu, other = replay.devices
+            self.assertEqual(gpu.name, 'gpu')
+            self.assertEqual(list(gpu.gpu_usage.Last(5)), [0, 10, 20, 30, 40])
+            self.assertEqual(other.gpu_usage.Latest(), 4)
+            self.assertEqual(gpu.power_watts, 104.0)
+            replay.Seek(2)
+            self.assertEqual(gpu.power_watts, 101.0)
+            self.assertEqual(gpu.gpu_usage.Latest(), 10)
+            del replay
+
+            ranged = Replay(path, start=1.0, end=3.0)
+            self.assertEqual((ranged.begin, ranged.end, ranged.position), (1, 4, 4))
+            ranged.paused = False
+            ranged.Seek(2)
+            ranged.time = 1002.5
+            ranged.lastUpdate = time.monotonic()
+            ranged.Update()
+            self.assertEqual(ranged.position, 3)
+            del ranged
+        finally:
+            if os.path.exists(path):
+                os.unlink(path)
+
+
+class TriggerTest(unittest.TestCase):
+    def testCondition(self):
+        condition = Condition('gpu1.gpu_usage < 30 for 200 ms')
+        self.assertEqual(condition.device, 'gpu1')
+        self.assertEqual(condition.metric, 'gpu_usage')
+        self.assertEqual(condition.value, 30.0)
+        self.assertAlmostEqual(condition.duration, 0.2)
+        self.assertTrue(condition.compare(29, condition.value))
+        self.assertTrue(Condition('pcie_bw > 90% of link').ofLink)
+
+    def testBadConditions(self):
+        for text in ['gpu_usage ~ 30', 'gpu_usage > 90%', 'gpu_usage > 90% of link', 'gpu_usage > 1 for 2 h']:
+            self.assertRaises(ValueError, Condition, text)
+
+    def testFiresOnceWhileHolding(self):
+        gpu = FakeDevice('gpu')
+        cpu = FakeDevice('cpu')
+        cpu.METRICS = ['cpu_usage']
+        cpu.cpu_usage = RingBuffer(8)
+        trigger = Trigger('gpu_usage < 30 for 1 s while cpu_usage > 90')
+        trigger.Bind([gpu], cpu)
+        gpu.gpu_usage.Append(10)
+        cpu.cpu_usage.Append(95)
+        self.assertEqual(trigger.Update(0.0), [])
+        self.assertEqual(trigger.Update(1.0), [gpu])
+        self.assertEqual(trigger.Update(2.0), [])
+        cpu.cpu_usage.Append(50)
+        self.assertEqual(trigger.Update(3.0), [])
+
+
+class CgroupParsingTest(unittest.TestCase):
+    def testCpuMax(self):
+        self.assertEqual(parseCpuMax('200000 100000\n'), 2.0)
+        self.assertIsNone(parseCpuMax('max 100000\n'))
+        self.assertIsNone(parseCpuMax('100000 0\n'))
+
+    def testPressure(self):
+        text = 'some avg10=12.50 avg60=3.00 avg300=1.00 total=123\nfull avg10=1.00 avg60=0.00 avg300=0.00 total=4\n'
+        self.assertEqual(parsePressure(text), 12.5)
+        self.assertEqual(parsePressure(''), 0.0)
+
+
+if __name__ == '__main__':
+    unittest.main()